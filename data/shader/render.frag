@@ -14,6 +14,12 @@ uniform sampler2D vram;
 uniform uvec2 drawingAreaTopLeft;
 uniform uvec2 drawingAreaBottomRight;
 
+uniform uvec2 textureWindowMask;
+uniform uvec2 textureWindowOffset;
+
+// 0 - all pixels, 1 - only texels without mask bit (opaque), 2 - only texels with mask bit (semi transparent)
+uniform int blendPass;
+
 const float W = 1024.f;
 const float H = 512.f;
 
@@ -100,14 +106,21 @@ void main()
 	if (x < drawingAreaTopLeft.x || x > drawingAreaBottomRight.x ||
 		y < drawingAreaTopLeft.y || y > drawingAreaBottomRight.y) discard;
 
+	// Texture masking
+	uvec2 texel = uvec2(fragTexcoord);
+	texel = (texel & ~(textureWindowMask * 8u)) | ((textureWindowOffset & textureWindowMask) * 8u);
+	vec2 coord = vec2(texel);
+
 	vec4 color;
-	if (fragBitcount == 4U) color = clut4bit(fragTexcoord, fragClut);
-	else if (fragBitcount == 8U) color = clut8bit(fragTexcoord, fragClut);
-	else if (fragBitcount == 16U) color = read16bit(fragTexcoord);
-	else color = vec4(fragColor, 0.0);
+	if (fragBitcount == 4U) color = clut4bit(coord, fragClut);
+	else if (fragBitcount == 8U) color = clut8bit(coord, fragClut);
+	else if (fragBitcount == 16U) color = read16bit(coord);
+	else color = vec4(floor(fragColor * (255.0 / 8.0) + 0.0001) / 31.0, 0.0);  // 24 to 15 bit, low bits are dropped
 
 	// Transparency
 	if (((fragFlags & 1u) == 1u || fragBitcount > 0u) && internalToPsxColor(color) == 0x0000u) discard;
+	if (blendPass == 1 && color.a >= 0.5) discard;
+	if (blendPass == 2 && color.a < 0.5) discard;
 
 	// If textured and if not raw texture, add brightness
 	if (fragBitcount > 0u && (fragFlags & 2u) != 2u) {
@@ -22,6 +22,13 @@ newoption {
 filter "options:enable-io-log"
 	defines "ENABLE_IO_LOG"
 
+newoption {
+	trigger = "enable-tiled-vram",
+	description = "Store VRAM in 32x32 pixel tiles (cache friendly texture sampling)",
+}
+filter "options:enable-tiled-vram"
+	defines "ENABLE_TILED_VRAM"
+
 project "glad"
 	uuid "9add6bd2-2372-4614-a367-2e8863415083"
 	kind "StaticLib"
@@ -48,6 +55,29 @@ project "imgui"
 		"externals/imgui/imgui_draw.cpp",
 	}
 
+project "cdz"
+	uuid "5d3e1f0c-7b8a-4e2b-9c61-2f4a8d9e0b73"
+	kind "ConsoleApp"
+	language "c++"
+	location "build/libs/cdz"
+	targetdir "build/%{cfg.buildcfg}"
+	flags { "C++14" }
+	includedirs { 
+		"src"
+	}
+	files { 
+		"src/tools/cdz.cpp",
+		"src/utils/**.h",
+		"src/utils/**.cpp"
+	}
+	filter "action:vs*"
+		defines "_CRT_SECURE_NO_WARNINGS"
+	filter "system:linux"
+		links { 
+			"pthread"
+		}
+	filter {}
+
 project "avocado"
 	uuid "c2c4899a-ddca-491f-9a66-1d33173a553e"
 	kind "ConsoleApp"
@@ -74,7 +104,8 @@ project "avocado"
 	removefiles {
 		"src/imgui/**.*",
 		"src/renderer/**.*",
-		"src/platform/**.*"
+		"src/platform/**.*",
+		"src/tools/**.*"
 	}
 	
 	filter "configurations:Debug"
@@ -132,10 +163,19 @@ project "avocado"
 			"C:/sdk/SDL2-2.0.5/include"
 		}
 		
+	filter "system:linux"
+		links { 
+			"pthread"
+		}
+
 	filter {"system:linux", "options:headless"}
+		includedirs { 
+			"externals/lodepng"
+		}
 		files { 
 			"src/platform/headless/**.cpp",
-			"src/platform/headless/**.h"
+			"src/platform/headless/**.h",
+			"externals/lodepng/lodepng.cpp"
 		}
 
 -- TODO: Make headless and normal configurations
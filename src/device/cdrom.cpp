@@ -1,8 +1,10 @@
 #include "cdrom.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "mips.h"
-#include "sound/audio_cd.h"
 #include "utils/bcd.h"
 
 #define dma3 dynamic_cast<device::dma::dmaChannel::DMA3Channel*>(cpu->dma->dma[3].get())
@@ -11,7 +13,105 @@ namespace device {
 namespace cdrom {
 CDROM::CDROM(mips::CPU* cpu) : cpu(cpu) {}
 
-void CDROM::step() {
+bool CDROM::insertDisc(const utils::Cue& newCue) {
+    auto image = std::make_shared<utils::DiscImage>();
+    if (!image->load(newCue)) {
+        cue = utils::Cue();
+        disc = nullptr;
+        dma3->setDisc(nullptr);
+        return false;
+    }
+
+    cue = newCue;
+    disc = image;
+    dma3->setDisc(disc);
+    return true;
+}
+
+int CDROM::sectorCycles() const {
+    // Streamed XA audio has to arrive in real time
+    if (xaEnabled) return CPU_CLOCK / (SECTORS_PER_SECOND * (doubleSpeed ? 2 : 1));
+
+    if (speedMultiplier <= 0) return INSTANT_SECTOR_CYCLES;
+    return CPU_CLOCK / (SECTORS_PER_SECOND * (doubleSpeed ? 2 : 1) * speedMultiplier);
+}
+
+int CDROM::seekCycles(int from, int to) const {
+    if (speedMultiplier <= 0) return INSTANT_SECTOR_CYCLES;
+
+    // Rough model of sled movement: fixed settle time plus time proportional to distance,
+    // full stroke across 72 minute disc takes about 300 ms.
+    const int64_t fullStroke = 72 * 60 * SECTORS_PER_SECOND;
+    int64_t distance = std::min<int64_t>(std::abs(to - from), fullStroke);
+    int64_t ms = 20 + 280 * distance / fullStroke;
+    return (int)(CPU_CLOCK / 1000 * ms / speedMultiplier);
+}
+
+void CDROM::startReading() {
+    readCycles = sectorCycles();
+    if (seekPending) {
+        readCycles += seekCycles(headSector, readSector);
+        headSector = readSector;
+        seekPending = false;
+        resetXa();
+    }
+}
+
+// Returns true if sector was consumed as XA-ADPCM audio and is not delivered to CPU
+bool CDROM::handleXaSector(int lba) {
+    if (!xaEnabled || !disc) return false;
+
+    const uint8_t* sector = disc->sector(lba, sectorBuffer);
+    if (sector == nullptr || !XaDecoder::isAudio(sector)) return false;
+
+    auto header = XaDecoder::subHeader(sector);
+    if (!xaFilter || (header.file == filterFile && header.channel == filterChannel)) {
+        size_t count = xaDecoder.decode(sector, xaSamples);
+        size_t written = xaPending.push(xaSamples, count);
+        if (written < count) printf("CDROM: XA buffer full, %zu samples dropped\n", count - written);
+    }
+    return true;
+}
+
+// Decoder history and samples not played yet belong to previous stream, drop them on seek, stop and filter change
+void CDROM::resetXa() {
+    xaDecoder.reset();
+    xaPending.clear();
+}
+
+// CD audio input of SPU: CD-DA sector under the head when playing, mixed with decoded XA-ADPCM
+void CDROM::outputAudio() {
+    const size_t count = AUDIO_FRAMES_PER_SECTOR * 2;
+    memset(audioOutput, 0, sizeof(audioOutput));
+
+    if (stat.play && disc) {
+        int lba = headSector++;
+        if (lba >= disc->getSectorCount()) {
+            // DataEnd
+            stat.setMode(StatusCode::Mode::None);
+            CDROM_interrupt.push_back(4);
+            writeResponse(stat._reg);
+        } else {
+            // Data tracks and gaps are silent. Read-ahead of disc belongs to data reads (DMA3), so audio doesn't move it.
+            int track = disc->trackAt(lba);
+            const uint8_t* sector = nullptr;
+            if (track >= 0 && disc->getCue().tracks[track].type == utils::Track::Type::AUDIO) sector = disc->sector(lba, sectorBuffer);
+            // Little endian samples, as are all supported hosts
+            if (sector != nullptr) memcpy(audioOutput, sector, sizeof(audioOutput));
+        }
+    }
+
+    int16_t xa[count];
+    size_t xaCount = xaPending.pop(xa, count);
+    for (size_t i = 0; i < xaCount; i++) {
+        audioOutput[i] = (int16_t)std::min(std::max(audioOutput[i] + xa[i], -0x8000), 0x7fff);
+    }
+
+    if (muted) memset(audioOutput, 0, sizeof(audioOutput));
+    cpu->spu->pushCdAudio(audioOutput, count);
+}
+
+void CDROM::step(int cycles) {
     status.transmissionBusy = 0;
     if (!CDROM_interrupt.empty()) {
         if ((interruptEnable & 7) & (CDROM_interrupt.front() & 7)) {
@@ -20,19 +120,36 @@ void CDROM::step() {
     }
 
     if (stat.read) {
-        static int cnt = 0;
-
-        if (++cnt == 500) {
-            cnt = 0;
-            ackMoreData();
+        readCycles -= cycles;
+
+        // In instant mode next sector waits until previous one is acknowledged
+        bool ready = readCycles <= 0 && (speedMultiplier > 0 || xaEnabled || CDROM_interrupt.empty());
+        if (ready) {
+            readCycles = std::max(readCycles + sectorCycles(), 0);
+            if (handleXaSector(headSector)) {
+                xaSkipped = true;
+            } else {
+                if (xaSkipped) {
+                    dma3->seekTo(headSector);
+                    xaSkipped = false;
+                }
+                ackMoreData();
+            }
+            headSector++;
         }
     }
 
+    audioCycles -= cycles;
+    while (audioCycles <= 0) {
+        audioCycles += CPU_CLOCK / SECTORS_PER_SECOND;
+        outputAudio();
+    }
+
     static int reportcnt = 0;
     if (report && stat.play && reportcnt++ == 4000) {
         reportcnt = 0;
         // Report--> INT1(stat, track, index, mm / amm, ss + 80h / ass, sect / asect, peaklo, peakhi)
-        auto pos = AudioCD::currentPosition;
+        auto pos = utils::Position::fromLba(headSector);
 
         int track = 0;
         for (int i = 0; i < cue.getTrackCount(); i++) {
@@ -117,6 +234,7 @@ void CDROM::cmdSetloc() {
     if (verbose) printf("Setloc: min: %d  sec: %d  sect: %d\n", minute, second, sector);
 
     readSector = sector + (second * 75) + (minute * 60 * 75);
+    seekPending = true;
     dma3->seekTo(readSector);
 
     CDROM_interrupt.push_back(3);
@@ -124,7 +242,6 @@ void CDROM::cmdSetloc() {
 }
 
 void CDROM::cmdPlay() {
-    // Play NOT IMPLEMENTED
     utils::Position pos;
     if (!CDROM_params.empty()) {
         int track = readParam();  // param or setloc used
@@ -144,11 +261,14 @@ void CDROM::cmdPlay() {
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
 
-    AudioCD::play(cue, pos);
+    // Samples are produced by outputAudio, starting with next sector period
+    headSector = pos.toLba();
+    seekPending = false;
 }
 
 void CDROM::cmdReadN() {
     stat.setMode(StatusCode::Mode::Reading);
+    startReading();
 
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
@@ -168,14 +288,13 @@ void CDROM::cmdStop() {
     printf("CDROM: STOP\n");
     stat.setMode(StatusCode::Mode::None);
     stat.motor = 0;
+    resetXa();
 
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
 
     CDROM_interrupt.push_back(2);
     writeResponse(stat._reg);
-
-    AudioCD::stop();
 }
 
 void CDROM::cmdPause() {
@@ -184,11 +303,10 @@ void CDROM::cmdPause() {
     writeResponse(stat._reg);
 
     stat.setMode(StatusCode::Mode::None);
+    resetXa();
 
     CDROM_interrupt.push_back(2);
     writeResponse(stat._reg);
-
-    AudioCD::stop();
 }
 
 void CDROM::cmdInit() {
@@ -199,26 +317,32 @@ void CDROM::cmdInit() {
     stat.setMode(StatusCode::Mode::None);
 
     sectorSize = false;
+    doubleSpeed = false;
+    xaEnabled = false;
+    xaFilter = false;
     dma3->sectorSize = sectorSize;
+    resetXa();
 
     CDROM_interrupt.push_back(2);
     writeResponse(stat._reg);
 }
 
 void CDROM::cmdMute() {
+    muted = true;
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
 }
 
 void CDROM::cmdDemute() {
+    muted = false;
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
 }
 
 void CDROM::cmdSetFilter() {
-    // TODO: Stub!
-    int file = readParam();
-    int channel = readParam();
+    filterFile = readParam();
+    filterChannel = readParam();
+    resetXa();
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
 }
@@ -227,6 +351,11 @@ void CDROM::cmdSetmode() {
     uint8_t setmode = CDROM_params.front();
     CDROM_params.pop_front();
 
+    bool xaChanged = xaEnabled != (bool)(setmode & (1 << 6)) || xaFilter != (bool)(setmode & (1 << 3));
+    doubleSpeed = setmode & (1 << 7) ? true : false;
+    xaEnabled = setmode & (1 << 6) ? true : false;
+    xaFilter = setmode & (1 << 3) ? true : false;
+    if (xaChanged) resetXa();
     sectorSize = setmode & (1 << 5) ? true : false;
     report = setmode & (1 << 2) ? true : false;
     dma3->sectorSize = sectorSize;
@@ -278,7 +407,7 @@ void CDROM::cmdGetlocL() {
 }
 
 void CDROM::cmdGetlocP() {
-    auto pos = AudioCD::currentPosition;
+    auto pos = utils::Position::fromLba(headSector);
 
     int track = 0;
     for (int i = 0; i < cue.getTrackCount(); i++) {
@@ -407,6 +536,7 @@ void CDROM::cmdGetId() {
 
 void CDROM::cmdReadS() {
     stat.setMode(StatusCode::Mode::Reading);
+    startReading();
 
     CDROM_interrupt.push_back(3);
     writeResponse(stat._reg);
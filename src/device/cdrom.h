@@ -2,12 +2,17 @@
 #include <deque>
 #include <memory>
 #include "device.h"
+#include "sound/xa_adpcm.h"
 #include "utils/cue/cue.h"
+#include "utils/cue/discImage.h"
+#include "utils/ring_buffer.h"
 
 namespace device {
 namespace cdrom {
 
 class CDROM {
+    static const int AUDIO_FRAMES_PER_SECTOR = 588;  // 2352 bytes of 16 bit stereo CD-DA
+
     union StatusCode {
         enum class Mode { None, Reading, Seeking, Playing };
         struct {
@@ -85,6 +90,38 @@ class CDROM {
     mips::CPU *cpu = nullptr;
     int readSector = 0;
 
+    // Sector delivery timing
+    bool doubleSpeed = false;
+    bool seekPending = false;  // Setloc issued, next read starts with seek
+    int headSector = 0;        // Drive head position (LBA)
+    int readCycles = 0;        // Cycles left until next sector
+
+    // XA-ADPCM streaming
+    bool xaEnabled = false;  // Audio sectors are decoded instead of being delivered to CPU
+    bool xaFilter = false;   // Only sectors matching filterFile and filterChannel are played
+    bool muted = false;
+    uint8_t filterFile = 0;
+    uint8_t filterChannel = 0;
+    bool xaSkipped = false;  // Audio sectors were consumed, DMA3 has to catch up with drive head
+    XaDecoder xaDecoder;
+    int16_t xaSamples[XaDecoder::MAX_OUTPUT];
+    // Decoded XA waiting for output, arrives in bursts of one sector and must fit next one before previous is played
+    utils::RingBuffer<int16_t, 1 << 16> xaPending;
+    static_assert(decltype(xaPending)::capacity() >= 2 * XaDecoder::MAX_OUTPUT, "xaPending can't hold two sectors of XA audio");
+
+    // CD audio sent to SPU, one sector worth of samples every 1/75 s of emulated time
+    int audioCycles = 0;
+    int16_t audioOutput[AUDIO_FRAMES_PER_SECTOR * 2];
+    uint8_t sectorBuffer[utils::Track::SECTOR_SIZE];  // Sector storage for compressed images
+
+    bool handleXaSector(int lba);
+    void resetXa();
+    void outputAudio();
+
+    int sectorCycles() const;
+    int seekCycles(int from, int to) const;
+    void startReading();
+
     StatusCode stat;
 
     void cmdGetstat();
@@ -132,13 +169,22 @@ class CDROM {
     }
 
    public:
+    static const int SECTORS_PER_SECOND = 75;  // Single speed
+    static const int INSTANT_SECTOR_CYCLES = 3000;
+
     utils::Cue cue;
+    std::shared_ptr<utils::DiscImage> disc;  // Sector data of cue, shared with DMA3
+
+    int speedMultiplier = 1;  // Read speed relative to real drive, 1 - accurate, 0 - instant
 
     CDROM(mips::CPU *cpu);
-    void step();
+    void step(int cycles);
     uint8_t read(uint32_t address);
     void write(uint32_t address, uint8_t data);
 
+    // Maps all files of cue, on failure drive is left without disc
+    bool insertDisc(const utils::Cue &newCue);
+
     void setShell(bool opened) { stat.setShell(opened); }
     bool getShell() const { return stat.getShell(); }
     void toggleShell() { stat.toggleShell(); }
@@ -3,6 +3,9 @@
 
 typedef uint32_t Bit;
 
+// 33.8688 MHz, exactly 768 cycles per 44.1 kHz audio sample
+const int CPU_CLOCK = 33868800;
+
 union Reg16 {
     uint16_t _reg;
     uint8_t _byte[2];
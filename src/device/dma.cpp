@@ -9,7 +9,7 @@ DMA::DMA(mips::CPU *cpu) : cpu(cpu) {
     dma[1] = std::make_unique<dmaChannel::DMAChannel>(1, cpu);
     dma[2] = std::make_unique<dmaChannel::DMA2Channel>(2, cpu, cpu->gpu.get());
     dma[3] = std::make_unique<dmaChannel::DMA3Channel>(3, cpu);
-    dma[4] = std::make_unique<dmaChannel::DMAChannel>(4, cpu);
+    dma[4] = std::make_unique<dmaChannel::DMA4Channel>(4, cpu, cpu->spu.get());
     dma[5] = std::make_unique<dmaChannel::DMAChannel>(5, cpu);
     dma[6] = std::make_unique<dmaChannel::DMA6Channel>(6, cpu);
 }
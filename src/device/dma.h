@@ -3,6 +3,7 @@
 #include "device.h"
 #include "dma2Channel.h"
 #include "dma3Channel.h"
+#include "dma4Channel.h"
 #include "dma6Channel.h"
 #include "dmaChannel.h"
 #include "gpu/gpu.h"
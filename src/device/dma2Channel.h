@@ -9,6 +9,8 @@ class DMA2Channel : public DMAChannel {
 
     uint32_t readDevice() override { return gpu->read(0); }
     void writeDevice(uint32_t data) override { gpu->write(0, data); }
+    void readBlock(uint32_t *data, size_t count) override { gpu->readBlock(data, count); }
+    void writeBlock(const uint32_t *data, size_t count) override { gpu->writeBlock(data, count); }
 
    public:
     DMA2Channel(int channel, mips::CPU *cpu, GPU *gpu) : DMAChannel(channel, cpu), gpu(gpu) {}
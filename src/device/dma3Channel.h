@@ -1,18 +1,21 @@
 #pragma once
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include "dmaChannel.h"
-#include "utils/file.h"
+#include "utils/cue/discImage.h"
 
 namespace device {
 namespace dma {
 namespace dmaChannel {
 class DMA3Channel : public DMAChannel {
-    static const int SECTOR_SIZE = 2352;
+    static const int SECTOR_SIZE = utils::DiscImage::SECTOR_SIZE;
 
     uint32_t readDevice() override {
         uint32_t data = 0;
-        if (f == nullptr) return data;
-        for (int i = bytesReaded; i < bytesReaded + 4; i++) {
-            data |= buffer[i] << (i * 8);
+        if (!disc) return data;
+        for (int i = 0; i < 4 && bytesReaded + i < SECTOR_SIZE; i++) {
+            data |= sectorData[bytesReaded + i] << (i * 8);
         }
         bytesReaded += 4;
         return data;
@@ -20,16 +23,29 @@ class DMA3Channel : public DMAChannel {
 
     void writeDevice(uint32_t data) override {}
 
+    void readBlock(uint32_t* data, size_t count) override {
+        if (!disc) {
+            memset(data, 0, count * 4);
+            return;
+        }
+        size_t left = bytesReaded < SECTOR_SIZE ? SECTOR_SIZE - bytesReaded : 0;
+        size_t available = std::min(count * 4, left);
+        memcpy(data, sectorData + bytesReaded, available);
+        memset((uint8_t*)data + available, 0, count * 4 - available);
+        bytesReaded += count * 4;
+    }
+
     void beforeRead() override {
-        if (f == nullptr) return;
+        if (!disc) return;
         if (bytesReaded >= (!sectorSize ? 0x800 : 0x924)) {  // 0x800 instead of 0x924 helps some games, hmm ...
             sector++;
             doSeek = true;
         }
 
         if (doSeek) {
-            fseek(f, sector * SECTOR_SIZE, SEEK_SET);
-            fread(buffer, SECTOR_SIZE, 1, f);
+            // Points directly into mapped image (or buffer for compressed one), sectors missing from image read as zeroes
+            sectorData = disc->read(sector, buffer);
+            if (sectorData == nullptr) sectorData = emptySector();
             doSeek = false;
 
             bytesReaded = 12;
@@ -43,43 +59,36 @@ class DMA3Channel : public DMAChannel {
         if (verbose) printf("Sector 0x%x  ", sector);
     }
 
-    FILE* f = nullptr;
-    int sector = 0;
+    std::shared_ptr<utils::DiscImage> disc;
+    const uint8_t* sectorData = emptySector();
+    uint8_t buffer[SECTOR_SIZE];
+    int sector = 0;  // Absolute LBA
     bool doSeek = true;
-    int fileSize = 0;
+
+    static const uint8_t* emptySector() {
+        static const uint8_t empty[SECTOR_SIZE] = {};
+        return empty;
+    }
 
    public:
     int bytesReaded = 0;
-    uint8_t buffer[SECTOR_SIZE];
     bool sectorSize = false;
 
     DMA3Channel(int channel, mips::CPU* cpu) : DMAChannel(channel, cpu) { verbose = false; }
 
-    bool load(const std::string& iso) {
-        if (f != nullptr) {
-            fclose(f);
-            f = nullptr;
-        }
-
-        f = fopen(iso.c_str(), "rb");
-        if (!f) {
-            return false;
-        }
-
-        fseek(f, 0, SEEK_END);
-        fileSize = ftell(f);
-        rewind(f);
-        return true;
+    void setDisc(std::shared_ptr<utils::DiscImage> disc) {
+        this->disc = disc;
+        sectorData = emptySector();
+        doSeek = true;
     }
 
     void seekTo(uint32_t destSector) {
-        sector = destSector - 150;
+        if (disc) disc->prefetch(destSector);
+        sector = destSector;
         doSeek = true;
         bytesReaded = 0;
     }
 
-    size_t getIsoSize() const { return fileSize; }
-
     void advanceSector() {
         if (bytesReaded == 0) return;
         sector++;
@@ -89,7 +98,8 @@ class DMA3Channel : public DMAChannel {
 
     uint8_t readByte() {
         beforeRead();
-        return buffer[bytesReaded++];
+        if (bytesReaded >= SECTOR_SIZE) return 0;
+        return sectorData[bytesReaded++];
     }
 };
 }  // namespace dmaChannel
@@ -0,0 +1,19 @@
+#pragma once
+#include "dmaChannel.h"
+#include "spu.h"
+
+namespace device {
+namespace dma {
+namespace dmaChannel {
+class DMA4Channel : public DMAChannel {
+    SPU *spu = nullptr;
+
+    void readBlock(uint32_t *data, size_t count) override { spu->readBlock(data, count); }
+    void writeBlock(const uint32_t *data, size_t count) override { spu->writeBlock(data, count); }
+
+   public:
+    DMA4Channel(int channel, mips::CPU *cpu, SPU *spu) : DMAChannel(channel, cpu), spu(spu) {}
+};
+}
+}
+}
@@ -1,6 +1,7 @@
 #include "dmaChannel.h"
-#include "mips.h"
+#include <algorithm>
 #include <cstdio>
+#include "mips.h"
 
 namespace device {
 namespace dma {
@@ -9,6 +10,74 @@ DMAChannel::DMAChannel(int channel, mips::CPU *cpu) : channel(channel), cpu(cpu)
 
 void DMAChannel::step() {}
 
+void DMAChannel::readBlock(uint32_t *data, size_t count) {
+    for (size_t i = 0; i < count; i++) data[i] = readDevice();
+}
+
+void DMAChannel::writeBlock(const uint32_t *data, size_t count) {
+    for (size_t i = 0; i < count; i++) writeDevice(data[i]);
+}
+
+namespace {
+const uint32_t RAM_MASK = mips::CPU::RAM_SIZE - 1;
+
+inline uint32_t *ramPointer(mips::CPU *cpu, uint32_t address) { return (uint32_t *)&cpu->ram[address & RAM_MASK & ~3]; }
+
+// Words left until the end of RAM
+inline size_t wordsToRamEnd(uint32_t address) { return (mips::CPU::RAM_SIZE - (address & RAM_MASK & ~3)) / 4; }
+}  // namespace
+
+void DMAChannel::toRam(uint32_t address, size_t count) {
+    while (count > 0) {
+        size_t n = std::min(count, wordsToRamEnd(address));
+        readBlock(ramPointer(cpu, address), n);
+        address += n * 4;
+        count -= n;
+    }
+}
+
+void DMAChannel::fromRam(uint32_t address, size_t count) {
+    while (count > 0) {
+        size_t n = std::min(count, wordsToRamEnd(address));
+        writeBlock(ramPointer(cpu, address), n);
+        address += n * 4;
+        count -= n;
+    }
+}
+
+void DMAChannel::clearOrderingTable(uint32_t address, size_t count) {
+    // Each entry points to previous one, last (lowest) one is the end marker
+    for (size_t i = 0; i < count; i++, address -= 4) {
+        *ramPointer(cpu, address) = (i == count - 1) ? 0xffffff : ((address - 4) & 0xffffff);
+    }
+}
+
+void DMAChannel::transferLinkedList(uint32_t address) {
+    if (visitedNodes.empty()) visitedNodes.resize(mips::CPU::RAM_SIZE / 4);
+
+    // Nodes are remembered to detect loops, only these are cleared afterwards
+    std::vector<uint32_t> nodes;
+    for (;;) {
+        uint32_t node = (address & RAM_MASK) / 4;
+        if (visitedNodes[node]) {
+            printf("DMA%d linked list loop at 0x%06x, breaking.\n", channel, address);
+            break;
+        }
+        visitedNodes[node] = true;
+        nodes.push_back(node);
+
+        uint32_t blockInfo = *ramPointer(cpu, address);
+        int commandCount = blockInfo >> 24;
+
+        fromRam(address + 4, commandCount);
+
+        address = blockInfo & 0xffffff;
+        if ((address & 0x800000) || address == 0) break;
+    }
+
+    for (uint32_t node : nodes) visitedNodes[node] = false;
+}
+
 uint8_t DMAChannel::read(uint32_t address) {
     if (address < 0x4) return baseAddress._byte[address];
     if (address >= 0x4 && address < 0x8) return count._byte[address - 4];
@@ -30,29 +99,21 @@ void DMAChannel::write(uint32_t address, uint8_t data) {
         control.startTrigger = CHCR::StartTrigger::clear;
 
         if (control.syncMode == CHCR::SyncMode::startImmediately) {
-            //            printf("DMA%d mode: word @ 0x%08x\n", channel, baseAddress.address);
-
-            // TODO: Check Transfer Direction
             // TODO: Check Memory Address Step
 
-            int addr = baseAddress.address;
-            if (channel == 3)  // CDROM
-            {
+            uint32_t addr = baseAddress.address;
+            size_t wordCount = count.syncMode0.wordCount;
+            if (wordCount == 0) wordCount = 0x10000;
+
+            if (channel == 6) {  // OTC
+                clearOrderingTable(addr, wordCount);
+            } else if (control.transferDirection == CHCR::TransferDirection::toMainRam) {
                 beforeRead();
-                if (verbose) printf("DMA%d CDROM -> CPU @ 0x%08x, count: 0x%04x\n", channel, addr, count.syncMode0.wordCount);
-                for (size_t i = 0; i < count.syncMode0.wordCount; i++) {
-                    cpu->writeMemory32(addr, readDevice());
-                    addr += 4;
-                }
-                // cpu->cdrom->status.dataFifoEmpty = 0;
+                if (verbose) printf("DMA%d -> CPU @ 0x%08x, count: 0x%04x\n", channel, addr, (int)wordCount);
+                toRam(addr, wordCount);
             } else {
-                for (size_t i = 0; i < count.syncMode0.wordCount; i++) {
-                    if (i == count.syncMode0.wordCount - 1)
-                        cpu->writeMemory32(addr, 0xffffff);
-                    else
-                        cpu->writeMemory32(addr, (addr - 4) & 0xffffff);
-                    addr -= 4;
-                }
+                if (verbose) printf("DMA%d CPU -> @ 0x%08x, count: 0x%04x\n", channel, addr, (int)wordCount);
+                fromRam(addr, wordCount);
             }
             control.enabled = CHCR::Enabled::stop;
         } else if (control.syncMode == CHCR::SyncMode::syncBlockToDmaRequests) {
@@ -64,12 +125,7 @@ void DMAChannel::write(uint32_t address, uint8_t data) {
             if (control.transferDirection == CHCR::TransferDirection::toMainRam)  // VRAM READ
             {
                 //               printf("DMA%d VRAM -> CPU @ 0x%08x, BS: 0x%04x, BC: 0x%04x\n", channel, addr, blockSize, blockCount);
-
-                for (int block = 0; block < blockCount; block++) {
-                    for (int i = 0; i < blockSize; i++, addr += 4) {
-                        cpu->writeMemory32(addr, readDevice());
-                    }
-                }
+                toRam(addr, (size_t)blockSize * blockCount);
             } else if (control.transferDirection == CHCR::TransferDirection::fromMainRam)  // VRAM WRITE
             {
                 if (channel == 3 && verbose) {
@@ -79,33 +135,11 @@ void DMAChannel::write(uint32_t address, uint8_t data) {
                     printf("DMA%d CPU -> SPU @ 0x%08x, BS: 0x%04x, BC: 0x%04x\n", channel, addr, blockSize, blockCount);
                 }
 
-                for (int block = 0; block < blockCount; block++) {
-                    for (int i = 0; i < blockSize; i++, addr += 4) {
-                        writeDevice(cpu->readMemory32(addr));
-                    }
-                }
+                fromRam(addr, (size_t)blockSize * blockCount);
             }
         } else if (control.syncMode == CHCR::SyncMode::linkedListMode) {
             //           printf("DMA%d linked list\n", channel);
-            int addr = baseAddress.address;
-
-            int breaker = 0;
-            for (;;) {
-                uint32_t blockInfo = cpu->readMemory32(addr);
-                int commandCount = blockInfo >> 24;
-
-                addr += 4;
-                for (int i = 0; i < commandCount; i++, addr += 4) {
-                    writeDevice(cpu->readMemory32(addr));
-                }
-                addr = blockInfo & 0xffffff;
-                if (addr == 0xffffff || addr == 0) break;
-
-                if (++breaker > 0x4000) {
-                    printf("GPU DMA transfer too long, breaking.\n");
-                    break;
-                }
-            }
+            transferLinkedList(baseAddress.address);
         }
 
         irqFlag = true;
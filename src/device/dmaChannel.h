@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "device.h"
 #include "gpu/gpu.h"
 
@@ -73,11 +74,23 @@ class DMAChannel {
     BCR count;
 
     mips::CPU *cpu;
+    std::vector<bool> visitedNodes;  // Linked list loop detection, one bit per RAM word
 
     virtual uint32_t readDevice() { return 0; }
     virtual void writeDevice(uint32_t data) {}
     virtual void beforeRead() {}
 
+    // Block transfers, data points directly to guest RAM.
+    // Default implementation goes word by word through readDevice/writeDevice.
+    virtual void readBlock(uint32_t *data, size_t count);
+    virtual void writeBlock(const uint32_t *data, size_t count);
+
+    // Transfers between device and RAM, blocks are split where RAM wraps around
+    void toRam(uint32_t address, size_t count);
+    void fromRam(uint32_t address, size_t count);
+    void clearOrderingTable(uint32_t address, size_t count);
+    void transferLinkedList(uint32_t address);
+
    protected:
     bool verbose = false;
 
@@ -0,0 +1,61 @@
+#include "display.h"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+inline uint32_t expand5(uint32_t c) { return (c << 3) | (c >> 2); }
+
+// Pixels are stored as 32 bit words 3 bytes apart, each store overwrites the spare byte of previous one.
+// dst needs one byte of room after the last pixel.
+void convertRow15(const uint16_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi16(0x1f);
+    for (; i + 8 <= count; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i r = _mm_and_si128(c, mask);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), mask);
+        __m128i b = _mm_and_si128(_mm_srli_epi16(c, 10), mask);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+        // 16 bit lanes of (g << 8 | r) and b interleaved into 32 bit 0BGR pixels
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        uint32_t pixels[8];
+        _mm_storeu_si128((__m128i*)pixels, _mm_unpacklo_epi16(rg, b));
+        _mm_storeu_si128((__m128i*)(pixels + 4), _mm_unpackhi_epi16(rg, b));
+        for (int j = 0; j < 8; j++) memcpy(dst + (i + j) * 3, &pixels[j], sizeof(uint32_t));
+    }
+#endif
+    for (; i < count; i++) {
+        uint32_t c = src[i];
+        uint32_t pixel = expand5(c & 0x1f) | expand5((c >> 5) & 0x1f) << 8 | expand5((c >> 10) & 0x1f) << 16;
+        memcpy(dst + i * 3, &pixel, sizeof(uint32_t));
+    }
+}
+}  // namespace
+
+void convertDisplay(const DisplaySnapshot& snapshot, DisplayImage& image) {
+    // Full VRAM view is always shown as 15 bit
+    bool bit24 = !snapshot.fullVram && snapshot.gp1_08.colorDepth == GP1_08::ColorDepth::bit24;
+
+    image.width = bit24 ? snapshot.w * 2 / 3 : snapshot.w;
+    image.height = snapshot.h;
+    const size_t size = image.width * image.height * 3;
+    image.rgb.resize(size + 1);
+
+    for (int y = 0; y < image.height; y++) {
+        const uint16_t* src = &snapshot.pixels[y * snapshot.w];
+        uint8_t* dst = &image.rgb[y * image.width * 3];
+        if (bit24) {
+            // Bytes of halfwords are R, G, B of consecutive pixels
+            memcpy(dst, src, image.width * 3);
+        } else {
+            convertRow15(src, dst, image.width);
+        }
+    }
+    image.rgb.resize(size);
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "gpu.h"
+
+// Displayed image in 8 bit per channel RGB (3 bytes per pixel, row by row)
+struct DisplayImage {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> rgb;
+};
+
+// CPU display stage, converts captured display area according to its color depth.
+// 15 bit colors are expanded to full 0-255 range, 24 bit mode is unpacked as is.
+void convertDisplay(const DisplaySnapshot& snapshot, DisplayImage& image);
@@ -1,13 +1,164 @@
 #include "gpu.h"
 #include <imgui.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <glm/glm.hpp>
+#include <thread>
+#include <utility>
+#include "rasterizer.h"
 #include "render.h"
 
 const char* CommandStr[] = {"None",           "FillRectangle",  "Polygon",       "Line",           "Rectangle",
                             "CopyCpuToVram1", "CopyCpuToVram2", "CopyVramToCpu", "CopyVramToVram", "Extra"};
 
+GPU::GPU() {
+    vram.resize(VRAM_WIDTH * VRAM_HEIGHT * resolutionMultiplier);
+    prevVram.resize(VRAM_WIDTH * VRAM_HEIGHT * resolutionMultiplier);
+    for (auto& map : vramDirty) map.markAll();
+
+    // Emulation thread renders too, leave it one core
+    int threads = std::min<int>(std::thread::hardware_concurrency(), 8) - 1;
+    rasterizer = std::make_unique<Rasterizer>(this, std::max(threads, 0));
+}
+
+GPU::~GPU() { setThreaded(false); }
+
+void GPU::flush() {
+    sync();
+    rasterizer->flush();
+    if (hardwareRenderer) hardwareRenderer->flush();
+}
+
+void GPU::markVramDirty(int x, int y, int w, int h) {
+    for (auto& map : vramDirty) map.mark(x, y, w, h);
+}
+
+void GPU::markVramDirty(const VramDirtyMap& area) {
+    for (auto& map : vramDirty) map.merge(area);
+}
+
+VramDirtyMap GPU::takeVramDirty(VramConsumer consumer) {
+    VramDirtyMap map = vramDirty[(int)consumer];
+    vramDirty[(int)consumer].clear();
+    return map;
+}
+
+void GPU::readVram(int x, int y, int w, int h, uint16_t* data) const {
+    for (int row = y; row < y + h; row++) {
+        for (int col = x; col < x + w;) {
+            int n = std::min(vramRun(col), x + w - col);
+            data = std::copy_n(&vram[vramIndex(col, row)], n, data);
+            col += n;
+        }
+    }
+}
+
+void GPU::writeVram(int x, int y, int w, int h, const uint16_t* data) {
+    for (int row = y; row < y + h; row++) {
+        for (int col = x; col < x + w;) {
+            int n = std::min(vramRun(col), x + w - col);
+            std::copy_n(data, n, &vram[vramIndex(col, row)]);
+            data += n;
+            col += n;
+        }
+    }
+}
+
+void GPU::snapshotVram() {
+    sync();
+    takeVramDirty(VramConsumer::Snapshot).forEachArea([this](int x, int y, int w, int h) {
+        for (int row = y; row < y + h; row++) {
+            for (int col = x; col < x + w;) {
+                int n = std::min(vramRun(col), x + w - col);
+                std::copy_n(&vram[vramIndex(col, row)], n, &prevVram[vramIndex(col, row)]);
+                col += n;
+            }
+        }
+    });
+}
+
+void GPU::snapshotDisplay(DisplaySnapshot& snapshot, bool fullVram) {
+    snapshot.displayAreaStartX = displayAreaStartX;
+    snapshot.displayAreaStartY = displayAreaStartY;
+    snapshot.gp1_08 = gp1_08;
+    snapshot.fullVram = fullVram;
+    // Line counter wraps at last line
+    snapshot.frameCycles = CYCLES_PER_LINE * (LINES_TOTAL_NTSC - 1);
+
+    if (fullVram) {
+        snapshot.x = 0;
+        snapshot.y = 0;
+        snapshot.w = VRAM_WIDTH;
+        snapshot.h = VRAM_HEIGHT;
+    } else {
+        int width = gp1_08.getHorizontalResoulution();
+        if (gp1_08.colorDepth == GP1_08::ColorDepth::bit24) width = width * 3 / 2;
+
+        snapshot.x = displayAreaStartX & (VRAM_WIDTH - 1);
+        snapshot.y = displayAreaStartY & (VRAM_HEIGHT - 1);
+        snapshot.w = std::min(width, VRAM_WIDTH - snapshot.x);
+        snapshot.h = std::min(gp1_08.getVerticalResoulution(), VRAM_HEIGHT - snapshot.y);
+    }
+
+    snapshot.pixels.resize(snapshot.w * snapshot.h);
+    readVram(snapshot.x, snapshot.y, snapshot.w, snapshot.h, snapshot.pixels.data());
+}
+
+void GPU::setThreaded(bool threaded) {
+    if (threaded == isThreaded()) return;
+
+    if (threaded) {
+        gpuThreadExit = false;
+        gpuThread = std::thread(&GPU::gpuThreadLoop, this);
+    } else {
+        sync();
+        {
+            std::lock_guard<std::mutex> lock(gpuThreadMutex);
+            gpuThreadExit = true;
+        }
+        gpuThreadWakeUp.notify_one();
+        gpuThread.join();
+    }
+}
+
+void GPU::sync() {
+    if (!isThreaded()) return;
+
+    while (processedWords.load(std::memory_order_acquire) != queuedWords) {
+        std::this_thread::yield();
+    }
+}
+
+void GPU::gpuThreadLoop() {
+    const int SPIN_COUNT = 1000;
+    uint32_t words[256];
+    int idle = 0;
+
+    while (!gpuThreadExit.load(std::memory_order_acquire)) {
+        size_t count = fifo.pop(words, 256);
+        if (count != 0) {
+            writeGP0(words, count);
+            processedWords.fetch_add(count, std::memory_order_release);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < SPIN_COUNT) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Nothing to do for a while, sleep until emulation thread queues more words
+        std::unique_lock<std::mutex> lock(gpuThreadMutex);
+        gpuThreadSleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        gpuThreadWakeUp.wait(lock, [this] { return !fifo.empty() || gpuThreadExit; });
+        gpuThreadSleeping = false;
+        idle = 0;
+    }
+}
+
 void GPU::reset() {
     irqRequest = false;
     displayDisable = true;
@@ -42,8 +193,10 @@ void GPU::drawPolygon(int16_t x[4], int16_t y[4], RGB c[4], TextureInfo t, bool
         baseX = t.getBaseX();
         baseY = t.getBaseY();
         bitcount = t.getBitcount();
-        flags |= (t.isTransparent()) << 6;
     }
+    // Textured polygons blend using mode from their own texpage, not from E1
+    int transparency = textured ? t.getTransparency() : (int)gp0_e1.semiTransparency;
+    flags |= transparency << Vertex::TRANSPARENCY_SHIFT;
 
     Vertex v[3];
     for (int i : {0, 1, 2}) {
@@ -59,7 +212,7 @@ void GPU::drawPolygon(int16_t x[4], int16_t y[4], RGB c[4], TextureInfo t, bool
     }
 }
 
-void GPU::cmdFillRectangle(uint8_t command, uint32_t arguments[]) {
+void GPU::cmdFillRectangle(uint8_t command, const uint32_t arguments[]) {
     // Note: documentation doesn't say anything about clipping to drawing area
     // but without it textures are being corrupted in some games (THPS2, Tekken)
     startX = minDrawingX(arguments[1] & 0xffff);
@@ -67,19 +220,25 @@ void GPU::cmdFillRectangle(uint8_t command, uint32_t arguments[]) {
     endX = maxDrawingX(startX + (arguments[2] & 0xffff));
     endY = maxDrawingY(startY + ((arguments[2] & 0xffff0000) >> 16));
 
-    uint32_t color = to15bit(arguments[0] & 0xffffff);
-
     // Note: not sure if coords should include last column and row
-    for (int y = startY; y < endY; y++) {
-        for (int x = startX; x < endX; x++) {
-            VRAM[y][x] = color;
-        }
+    Primitive p = {};
+    p.type = Primitive::Type::Fill;
+    p.min = glm::ivec2(startX, startY);
+    p.max = glm::ivec2(endX, endY);
+    p.flatColor = to15bit(arguments[0] & 0xffffff);
+    p.skippedField = skippedField();
+    if (collectingFillStats) frameFillStats.fills++;
+    if (hardwareRenderer) {
+        hardwareRenderer->fill(startX, startY, endX - startX, endY - startY, p.flatColor);
+    } else {
+        rasterizer->submit(p);
     }
 
     cmd = Command::None;
 }
 
-void GPU::cmdPolygon(PolygonArgs arg, uint32_t arguments[]) {
+void GPU::cmdPolygon(uint8_t command, const uint32_t arguments[]) {
+    PolygonArgs arg(command);
     int ptr = 1;
     int16_t x[4], y[4];
     RGB c[4] = {};
@@ -103,45 +262,78 @@ void GPU::cmdPolygon(PolygonArgs arg, uint32_t arguments[]) {
     if (arg.isRawTexture) flags |= Vertex::RawTexture;
     if (arg.gouroudShading) flags |= Vertex::GouroudShading;
     if (gp0_e1.dither24to15) flags |= Vertex::Dithering;
+    if (collectingFillStats) frameFillStats.polygons++;
     drawPolygon(x, y, c, tex, arg.isQuad, arg.isTextureMapped, flags);
 
     cmd = Command::None;
 }
 
-void GPU::cmdLine(LineArgs arg, uint32_t arguments[]) {
-    int ptr = 1;
-    int16_t x[2] = {}, y[2] = {};
-    RGB c[2] = {};
-
-    for (int i = 0; i < arg.getArgumentCount() - 1; i++) {
-        if (arguments[ptr] == 0x50005000 || arguments[ptr] == 0x55555555) break;
-        if (i == 0) {
-            x[0] = arguments[ptr] & 0xffff;
-            y[0] = (arguments[ptr++] & 0xffff0000) >> 16;
-            c[0].c = arguments[0] & 0xffffff;
-        } else {
-            x[0] = x[1];
-            y[0] = y[1];
-            c[0] = c[1];
-        }
+void GPU::cmdLine(uint8_t command, const uint32_t arguments[]) {
+    LineArgs arg(command);
+    lineFlags = 0;
+    if (arg.semiTransparency) lineFlags |= Vertex::SemiTransparency;
+    if (arg.gouroudShading) lineFlags |= Vertex::GouroudShading;
+    if (gp0_e1.dither24to15) lineFlags |= Vertex::Dithering;
+
+    lineVertex = arguments[1];
+    lineColor.c = arguments[0] & 0xffffff;
+    if (arg.gouroudShading) {
+        lineTo(arguments[3], arguments[2]);
+    } else {
+        lineTo(arguments[2], lineColor.c);
+    }
 
-        if (arg.gouroudShading)
-            c[1].c = arguments[ptr++];
-        else
-            c[1].c = arguments[0] & 0xffffff;
+    // Remaining polyline vertices are drawn as they arrive
+    cmd = arg.polyLine ? Command::Line : Command::None;
+}
 
-        x[1] = arguments[ptr] & 0xffff;
-        y[1] = (arguments[ptr++] & 0xffff0000) >> 16;
+size_t GPU::cmdPolyLine(const uint32_t* data, size_t count) {
+    const size_t vertexSize = (lineFlags & Vertex::GouroudShading) ? 2 : 1;
 
-        // No transparency support
-        // No Gouroud Shading
-        drawLine(this, x, y, c);
+    size_t i = 0;
+    while (i < count) {
+        // Terminator takes place of the next vertex (its color for shaded lines)
+        if (packet.empty() && isPolylineTerminator(data[i])) {
+            cmd = Command::None;
+            return i + 1;
+        }
+
+        const uint32_t* vertex;
+        if (packet.empty() && count - i >= vertexSize) {
+            vertex = &data[i];
+            i += vertexSize;
+        } else {
+            // Vertex split between writes
+            packet.push_back(data[i++]);
+            if (packet.size() < vertexSize) continue;
+            vertex = packet.data();
+        }
+
+        if (vertexSize == 2) {
+            lineTo(vertex[1], vertex[0]);
+        } else {
+            lineTo(vertex[0], lineColor.c);
+        }
+        packet.clear();
     }
+    return i;
+}
 
-    cmd = Command::None;
+void GPU::lineTo(uint32_t vertex, uint32_t color) {
+    int16_t x[2] = {(int16_t)(lineVertex & 0xffff), (int16_t)(vertex & 0xffff)};
+    int16_t y[2] = {(int16_t)(lineVertex >> 16), (int16_t)(vertex >> 16)};
+    RGB c[2];
+    c[0] = lineColor;
+    c[1].c = color & 0xffffff;
+    if (collectingFillStats) frameFillStats.lines++;
+    drawLine(this, x, y, c, lineFlags);
+
+    lineVertex = vertex;
+    lineColor = c[1];
 }
 
-void GPU::cmdRectangle(RectangleArgs arg, uint32_t arguments[]) {
+void GPU::cmdRectangle(uint8_t command, const uint32_t arguments[]) {
+    RectangleArgs arg(command);
     int16_t w = arg.getSize();
     int16_t h = arg.getSize();
 
@@ -198,61 +390,83 @@ void GPU::cmdRectangle(RectangleArgs arg, uint32_t arguments[]) {
     if (arg.semiTransparency) flags |= Vertex::SemiTransparency;
     if (arg.isRawTexture) flags |= Vertex::RawTexture;
 
+    if (collectingFillStats) frameFillStats.rectangles++;
     drawPolygon(_x, _y, _c, tex, true, arg.isTextureMapped, flags);
 
     cmd = Command::None;
 }
 
-void GPU::cmdCpuToVram1(uint8_t command, uint32_t arguments[]) {
+void GPU::cmdCpuToVram1(uint8_t command, const uint32_t arguments[]) {
     if ((arguments[0] & 0x00ffffff) != 0) {
-        printf("cmdCpuToVram1: Suspicious arg0: 0x%x\n", arguments[0]);
+        printf("cmdCpuToVram1: Suspicious arg0: 0x%x\n", arguments[0] & 0xffffff);
     }
+
     startX = currX = arguments[1] & 0xffff;
     startY = currY = (arguments[1] & 0xffff0000) >> 16;
 
     endX = startX + (arguments[2] & 0xffff);
     endY = startY + ((arguments[2] & 0xffff0000) >> 16);
 
+    // Payload is compared with current content of the area
+    rasterizer->flushForRead(startX, startY, endX - startX, endY - startY);
+
     cmd = Command::CopyCpuToVram2;
-    argumentCount = 1;
-    currentArgument = 0;
 }
 
-void GPU::cmdCpuToVram2(uint8_t command, uint32_t arguments[]) {
-    uint32_t byte = arguments[0];
+size_t GPU::cmdCpuToVram2(const uint32_t* data, size_t count) {
+    // Games upload the same textures and palettes over and over,
+    // VRAM is left untouched (and not reported as modified) if it already holds the payload
+    int firstRow = currY;
+    bool modified = false;
+    auto write = [&](uint16_t value) {
+        uint16_t& pixel = this->pixel(currX++ % VRAM_WIDTH, currY % VRAM_HEIGHT);
+        if (pixel != value) {
+            // Pending primitives sampling the area have to see previous content
+            if (!modified) rasterizer->flushForWrite(startX, startY, endX - startX, endY - startY);
+            modified = true;
+            pixel = value;
+        }
+        if (currX >= endX) {
+            currX = startX;
+            if (++currY >= endY) cmd = Command::None;
+        }
+    };
 
-    // TODO: ugly code
-    VRAM[currY % VRAM_HEIGHT][currX++ % VRAM_WIDTH] = byte & 0xffff;
-    if (currX >= endX) {
-        currX = startX;
-        if (++currY >= endY) cmd = Command::None;
+    size_t i = 0;
+    for (; i < count && cmd == Command::CopyCpuToVram2; i++) {
+        write(data[i] & 0xffff);
+        write(data[i] >> 16);
     }
-
-    VRAM[currY % VRAM_HEIGHT][currX++ % VRAM_WIDTH] = (byte >> 16) & 0xffff;
-    if (currX >= endX) {
-        currX = startX;
-        if (++currY >= endY) cmd = Command::None;
+    // Last halfword of odd sized transfer lands at the beginning of row after the area
+    if (modified) markVramDirty(startX, firstRow, endX - startX, currY - firstRow + 1);
+    if (hardwareRenderer) {
+        // Software VRAM is stale where host GPU has drawn, so the comparison above doesn't apply.
+        // Rows outside of transfer area have stale content in software VRAM
+        hardwareRenderer->vramWritten(this, startX, firstRow, endX - startX, std::min(currY, endY - 1) - firstRow + 1);
     }
-
-    currentArgument = 0;
+    return i;
 }
 
-void GPU::cmdVramToCpu(uint8_t command, uint32_t arguments[]) {
+void GPU::cmdVramToCpu(uint8_t command, const uint32_t arguments[]) {
     if ((arguments[0] & 0x00ffffff) != 0) {
-        printf("cmdVramToCpu: Suspicious arg0: 0x%x\n", arguments[0]);
+        printf("cmdVramToCpu: Suspicious arg0: 0x%x\n", arguments[0] & 0xffffff);
     }
+
     gpuReadMode = 1;
     startX = currX = arguments[1] & 0xffff;
     startY = currY = (arguments[1] & 0xffff0000) >> 16;
     endX = startX + (arguments[2] & 0xffff);
     endY = startY + ((arguments[2] & 0xffff0000) >> 16);
 
+    rasterizer->flushForRead(startX, startY, endX - startX, endY - startY);
+    if (hardwareRenderer) hardwareRenderer->vramRead(this, startX, startY, endX - startX, endY - startY);
+
     cmd = Command::None;
 }
 
-void GPU::cmdVramToVram(uint8_t command, uint32_t arguments[]) {
+void GPU::cmdVramToVram(uint8_t command, const uint32_t arguments[]) {
     if ((arguments[0] & 0x00ffffff) != 0) {
-        printf("cpuVramToVram: Suspicious arg0: 0x%x\n", arguments[0]);
+        printf("cpuVramToVram: Suspicious arg0: 0x%x\n", arguments[0] & 0xffffff);
     }
     int srcX = arguments[1] & 0xffff;
     int srcY = (arguments[1] & 0xffff0000) >> 16;
@@ -269,16 +483,33 @@ void GPU::cmdVramToVram(uint8_t command, uint32_t arguments[]) {
         return;
     }
 
+    rasterizer->flushForRead(srcX, srcY, width, height);
+    rasterizer->flushForWrite(dstX, dstY, width, height);
+    if (hardwareRenderer) hardwareRenderer->vramRead(this, srcX, srcY, width, height);
+
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            VRAM[(dstY + y) % VRAM_HEIGHT][(dstX + x) % VRAM_WIDTH] = VRAM[(srcY + y) % VRAM_HEIGHT][(srcX + x) % VRAM_WIDTH];
+            pixel((dstX + x) % VRAM_WIDTH, (dstY + y) % VRAM_HEIGHT) = pixel((srcX + x) % VRAM_WIDTH, (srcY + y) % VRAM_HEIGHT);
         }
     }
+    markVramDirty(dstX, dstY, width, height);
+    if (hardwareRenderer) hardwareRenderer->vramWritten(this, dstX, dstY, width, height);
 
     cmd = Command::None;
 }
 
+void GPU::publishGp0Status() {
+    uint32_t status = gp0_e1._reg & 0x7FF;
+    status |= gp0_e6.setMaskWhileDrawing << 11;
+    status |= gp0_e6.checkMaskBeforeDraw << 12;
+    status |= (uint8_t)gp0_e1.textureDisable << 15;
+    status |= irqRequest << 24;
+    status |= (cmd != Command::CopyCpuToVram2) << 27;
+    gp0Status.store(status, std::memory_order_release);
+}
+
 void GPU::step() {
+    const uint32_t status = gp0Status.load(std::memory_order_acquire);
     uint8_t dataRequest = 0;
     if (dmaDirection == 0)
         dataRequest = 0;
@@ -287,14 +518,11 @@ void GPU::step() {
     else if (dmaDirection == 2)
         dataRequest = 1;  // Same as bit28, ready to receive dma block
     else if (dmaDirection == 3)
-        dataRequest = cmd != Command::CopyCpuToVram2;  // Same as bit27, ready to send VRAM to CPU
+        dataRequest = (status >> 27) & 1;  // Same as bit27, ready to send VRAM to CPU
 
-    GPUSTAT = gp0_e1._reg & 0x7FF;
-    GPUSTAT |= gp0_e6.setMaskWhileDrawing << 11;
-    GPUSTAT |= gp0_e6.checkMaskBeforeDraw << 12;
+    GPUSTAT = status;
     GPUSTAT |= 1 << 13;  // always set
     GPUSTAT |= (uint8_t)gp1_08.reverseFlag << 14;
-    GPUSTAT |= (uint8_t)gp0_e1.textureDisable << 15;
     GPUSTAT |= (uint8_t)gp1_08.horizontalResolution2 << 16;
     GPUSTAT |= (uint8_t)gp1_08.horizontalResolution1 << 17;
     GPUSTAT |= (uint8_t)gp1_08.verticalResolution << 19;
@@ -302,23 +530,24 @@ void GPU::step() {
     GPUSTAT |= (uint8_t)gp1_08.colorDepth << 21;
     GPUSTAT |= gp1_08.interlace << 22;
     GPUSTAT |= displayDisable << 23;
-    GPUSTAT |= irqRequest << 24;
     GPUSTAT |= dataRequest << 25;
     GPUSTAT |= 1 << 26;  // Ready for DMA command
-    GPUSTAT |= (cmd != Command::CopyCpuToVram2) << 27;
     GPUSTAT |= 1 << 28;  // Ready for receive DMA block
     GPUSTAT |= (dmaDirection & 3) << 29;
-    GPUSTAT |= odd << 31;
+    GPUSTAT |= (uint32_t)odd.load() << 31;
 }
 
 uint32_t GPU::read(uint32_t address) {
     int reg = address & 0xfffffffc;
     if (reg == 0) {
+        // GPUREAD (VRAM to CPU transfer, GPU info) depends on all submitted commands
+        sync();
         if (gpuReadMode == 0 || gpuReadMode == 2) {
             return GPUREAD;
         }
         if (gpuReadMode == 1) {
-            uint32_t word = VRAM[currY][currX] | (VRAM[currY][currX + 1] << 16);
+            int y = currY % VRAM_HEIGHT;
+            uint32_t word = pixel(currX % VRAM_WIDTH, y) | (pixel((currX + 1) % VRAM_WIDTH, y) << 16);
             currX += 2;
 
             if (currX >= endX) {
@@ -339,124 +568,222 @@ uint32_t GPU::read(uint32_t address) {
 
 void GPU::write(uint32_t address, uint32_t data) {
     int reg = address & 0xfffffffc;
-    if (reg == 0) writeGP0(data);
-    if (reg == 4) writeGP1(data);
-}
-
-void GPU::writeGP0(uint32_t data) {
-    if (cmd == Command::None) {
-        command = data >> 24;
-        arguments[0] = data & 0xffffff;
-        argumentCount = 0;
-        currentArgument = 1;
-
-        if (command == 0x00) {
-            // NOP
-        } else if (command == 0x01) {
-            // Clear Cache
-        } else if (command == 0x02) {
-            // Fill rectangle
-            cmd = Command::FillRectangle;
-            argumentCount = 2;
-        } else if (command >= 0x20 && command < 0x40) {
-            // Polygons
-            cmd = Command::Polygon;
-            argumentCount = PolygonArgs(command).getArgumentCount();
-        } else if (command >= 0x40 && command < 0x60) {
-            // Lines
-            cmd = Command::Line;
-            argumentCount = LineArgs(command).getArgumentCount();
-        } else if (command >= 0x60 && command < 0x80) {
-            // Rectangles
-            cmd = Command::Rectangle;
-            argumentCount = RectangleArgs(command).getArgumentCount();
-        } else if (command == 0xa0) {
-            // Copy rectangle (CPU -> VRAM)
-            cmd = Command::CopyCpuToVram1;
-            argumentCount = 2;
-        } else if (command == 0xc0) {
-            // Copy rectangle (VRAM -> CPU)
-            cmd = Command::CopyVramToCpu;
-            argumentCount = 2;
-        } else if (command == 0x80) {
-            // Copy rectangle (VRAM -> VRAM)
-            cmd = Command::CopyVramToVram;
-            argumentCount = 3;
-        } else if (command == 0xe1) {
-            // Draw mode setting
-            gp0_e1._reg = arguments[0];
-        } else if (command == 0xe2) {
-            // Texture window setting
-            gp0_e2._reg = arguments[0];
-        } else if (command == 0xe3) {
-            // Drawing area top left
-            drawingAreaLeft = arguments[0] & 0x3ff;
-            drawingAreaTop = (arguments[0] & 0xffc00) >> 10;
-        } else if (command == 0xe4) {
-            // Drawing area bottom right
-            drawingAreaRight = arguments[0] & 0x3ff;
-            drawingAreaBottom = (arguments[0] & 0xffc00) >> 10;
-        } else if (command == 0xe5) {
-            // Drawing offset
-            drawingOffsetX = ((int16_t)((arguments[0] & 0x7ff) << 5)) >> 5;
-            drawingOffsetY = ((int16_t)(((arguments[0] & 0x3FF800) >> 11) << 5)) >> 5;
-        } else if (command == 0xe6) {
-            // Mask bit setting
-            gp0_e6._reg = arguments[0];
-        } else if (command == 0x1f) {
-            // Interrupt request
-            irqRequest = true;
-            // TODO: IRQ
-        } else {
-            printf("GP0(0x%02x) args 0x%06x\n", command, arguments[0]);
-        }
+    if (reg == 0) writeBlock(&data, 1);
+    if (reg == 4) {
+        // Display state is owned by emulation thread, GP1 is executed in order with queued GP0 words
+        sync();
+        writeGP1(data);
+    }
+}
 
-        if (gpuLogEnabled && cmd == Command::None) {
-            GPU_LOG_ENTRY entry;
-            entry.cmd = Command::Extra;
-            entry.command = command;
-            entry.args = std::vector<uint32_t>();
-            entry.args.push_back(arguments[0]);
-            gpuLogList.push_back(entry);
-        }
-        // if (cmd == Command::None) printf("GPU: 0x%02x\n", command);
+void GPU::readBlock(uint32_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) data[i] = read(0);
+}
 
-        argumentCount++;
+void GPU::writeBlock(const uint32_t* data, size_t count) {
+    if (!isThreaded()) {
+        writeGP0(data, count);
         return;
     }
 
-    if (currentArgument < argumentCount) {
-        arguments[currentArgument++] = data;
-        if (argumentCount == MAX_ARGS && (data == 0x50005000 || data == 0x55555555)) argumentCount = currentArgument;
-        if (currentArgument != argumentCount) return;
+    while (count > 0) {
+        size_t n = fifo.push(data, count);
+        if (n == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        data += n;
+        count -= n;
+        queuedWords += n;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (gpuThreadSleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(gpuThreadMutex);
+            gpuThreadWakeUp.notify_one();
+        }
+    }
+}
+
+void GPU::cmdExtra(uint8_t command, const uint32_t arguments[]) {
+    uint32_t argument = arguments[0] & 0xffffff;
+
+    if (command == 0x00) {
+        // NOP
+    } else if (command == 0x01) {
+        // Clear Cache
+    } else if (command == 0xe1) {
+        // Draw mode setting
+        gp0_e1._reg = argument;
+    } else if (command == 0xe2) {
+        // Texture window setting
+        gp0_e2._reg = argument;
+    } else if (command == 0xe3) {
+        // Drawing area top left
+        drawingAreaLeft = argument & 0x3ff;
+        drawingAreaTop = (argument & 0xffc00) >> 10;
+    } else if (command == 0xe4) {
+        // Drawing area bottom right
+        drawingAreaRight = argument & 0x3ff;
+        drawingAreaBottom = (argument & 0xffc00) >> 10;
+    } else if (command == 0xe5) {
+        // Drawing offset
+        drawingOffsetX = ((int16_t)((argument & 0x7ff) << 5)) >> 5;
+        drawingOffsetY = ((int16_t)(((argument & 0x3FF800) >> 11) << 5)) >> 5;
+    } else if (command == 0xe6) {
+        // Mask bit setting
+        gp0_e6._reg = argument;
+    } else if (command == 0x1f) {
+        // Interrupt request
+        irqRequest = true;
+        // TODO: IRQ
+    } else {
+        printf("GP0(0x%02x) args 0x%06x\n", command, argument);
+    }
+}
+
+namespace {
+struct CommandInfo {
+    Command cmd;
+    uint8_t length;  // Words including command word, for polylines - length of the first segment
+    void (GPU::*handler)(uint8_t command, const uint32_t arguments[]);
+};
+
+constexpr CommandInfo describeCommand(uint8_t command) {
+    if (command == 0x02) return {Command::FillRectangle, 3, &GPU::cmdFillRectangle};
+    if (command >= 0x20 && command < 0x40) {
+        // See PolygonArgs
+        int vertices = (command & 0x08) ? 4 : 3;
+        int length = 1 + vertices;
+        if (command & 0x04) length += vertices;
+        if (command & 0x10) length += vertices - 1;
+        return {Command::Polygon, (uint8_t)length, &GPU::cmdPolygon};
+    }
+    if (command >= 0x40 && command < 0x60) {
+        // See LineArgs, polyline vertices are streamed (see cmdPolyLine)
+        return {Command::Line, (uint8_t)((command & 0x10) ? 4 : 3), &GPU::cmdLine};
     }
+    if (command >= 0x60 && command < 0x80) {
+        // See RectangleArgs
+        int length = 2;
+        if ((command & 0x18) == 0) length++;
+        if (command & 0x04) length++;
+        return {Command::Rectangle, (uint8_t)length, &GPU::cmdRectangle};
+    }
+    if (command == 0x80) return {Command::CopyVramToVram, 4, &GPU::cmdVramToVram};
+    if (command == 0xa0) return {Command::CopyCpuToVram1, 3, &GPU::cmdCpuToVram1};
+    if (command == 0xc0) return {Command::CopyVramToCpu, 3, &GPU::cmdVramToCpu};
+    return {Command::Extra, 1, &GPU::cmdExtra};
+}
+
+struct CommandTable {
+    CommandInfo command[256];
+};
+
+template <size_t... I>
+constexpr CommandTable makeCommandTable(std::index_sequence<I...>) {
+    return {{describeCommand(I)...}};
+}
+
+constexpr CommandTable commandTable = makeCommandTable(std::make_index_sequence<256>());
 
-    if (gpuLogEnabled && cmd != Command::CopyCpuToVram2) {
-        GPU_LOG_ENTRY entry;
-        entry.cmd = cmd;
-        entry.command = command;
-        entry.args = std::vector<uint32_t>(arguments, arguments + argumentCount);
-        gpuLogList.push_back(entry);
+const uint64_t HASH_SEED = 14695981039346656037ull;
+
+// FNV-1a
+uint64_t hashWords(uint64_t hash, const uint32_t* words, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211ull;
     }
+    return hash;
+}
+
+// Length of packet starting at data[0], 0 if it isn't complete yet
+size_t packetLength(const uint32_t* data, size_t count) {
+    const CommandInfo& info = commandTable.command[data[0] >> 24];
+    return info.length <= count ? info.length : 0;
+}
+}  // namespace
+
+void GPU::writeGP0(const uint32_t* data, size_t count) {
+    while (count > 0) {
+        if (cmd == Command::CopyCpuToVram2) {
+            size_t n = cmdCpuToVram2(data, count);
+            data += n;
+            count -= n;
+            continue;
+        }
 
-    // printf("%s(0x%x)\n", CommandStr[(int)cmd], command);
+        if (cmd == Command::Line) {
+            size_t n = cmdPolyLine(data, count);
+            frameHash = hashWords(frameHash, data, n);
+            if (gpuLogEnabled && !gpuLogList.empty()) {
+                auto& args = gpuLogList.back().args;
+                args.insert(args.end(), data, data + n);
+            }
+            data += n;
+            count -= n;
+            continue;
+        }
 
-    if (cmd == Command::FillRectangle)
-        cmdFillRectangle(command, arguments);
-    else if (cmd == Command::Polygon)
-        cmdPolygon(command, arguments);
-    else if (cmd == Command::Line)
-        cmdLine(command, arguments);
-    else if (cmd == Command::Rectangle)
-        cmdRectangle(command, arguments);
-    else if (cmd == Command::CopyCpuToVram1)
-        cmdCpuToVram1(command, arguments);
-    else if (cmd == Command::CopyCpuToVram2)
-        cmdCpuToVram2(command, arguments);
-    else if (cmd == Command::CopyVramToCpu)
-        cmdVramToCpu(command, arguments);
-    else if (cmd == Command::CopyVramToVram)
-        cmdVramToVram(command, arguments);
+        const uint32_t* words = data;
+        size_t length;
+        if (packet.empty()) {
+            // Execute packets directly from source when possible
+            length = packetLength(data, count);
+            if (length == 0) {
+                packet.assign(data, data + count);
+                break;
+            }
+            data += length;
+            count -= length;
+        } else {
+            packet.push_back(*data++);
+            count--;
+            length = packetLength(packet.data(), packet.size());
+            if (length == 0) continue;
+            words = packet.data();
+        }
+
+        uint8_t command = words[0] >> 24;
+        const CommandInfo& info = commandTable.command[command];
+
+        if (gpuLogEnabled) {
+            GPU_LOG_ENTRY entry;
+            entry.cmd = info.cmd;
+            entry.command = command;
+            entry.args = std::vector<uint32_t>(words, words + length);
+            entry.args[0] &= 0xffffff;
+            gpuLogList.push_back(entry);
+        }
+
+        frameHash = hashWords(frameHash, words, length);
+        (this->*info.handler)(command, words);
+        packet.clear();
+    }
+    publishGp0Status();
+}
+
+void GPU::endFrame() {
+    sync();
+    rasterizer->endFrame(frameHash, frameCaching);
+    flush();
+
+    if (collectingFillStats) std::swap(fillStats, frameFillStats);
+    collectingFillStats = fillStatsEnabled && !hardwareRenderer;
+    if (collectingFillStats) frameFillStats.clear();
+    rasterizer->setStats(collectingFillStats ? &frameFillStats : nullptr);
+
+    // Primitives of the next frame depend on drawing state left by this one
+    uint32_t state[] = {
+        gp0_e1._reg,
+        gp0_e2._reg,
+        gp0_e6._reg,
+        (uint32_t)(uint16_t)drawingAreaLeft | (uint32_t)(uint16_t)drawingAreaTop << 16,
+        (uint32_t)(uint16_t)drawingAreaRight | (uint32_t)(uint16_t)drawingAreaBottom << 16,
+        (uint32_t)(uint16_t)drawingOffsetX | (uint32_t)(uint16_t)drawingOffsetY << 16,
+        textureDisableAllowed,
+    };
+    frameHash = hashWords(HASH_SEED, state, sizeof(state) / sizeof(state[0]));
 }
 
 void GPU::writeGP1(uint32_t data) {
@@ -466,7 +793,8 @@ void GPU::writeGP1(uint32_t data) {
     if (command == 0x00) {  // Reset GPU
         reset();
     } else if (command == 0x01) {  // Reset command buffer
-
+        packet.clear();
+        cmd = Command::None;
     } else if (command == 0x02) {  // Acknowledge IRQ1
         irqRequest = false;
     } else if (command == 0x03) {  // Display Enable
@@ -510,19 +838,18 @@ void GPU::writeGP1(uint32_t data) {
         assert(false);
     }
     // command 0x20 is not implemented
+    publishGp0Status();
 }
 
 bool GPU::emulateGpuCycles(int cycles) {
-    const int LINE_VBLANK_START_NTSC = 243;
-    const int LINES_TOTAL_NTSC = 263;
     static int gpuLine = 0;
     static int gpuDot = 0;
 
     gpuDot += cycles;
 
-    int newLines = gpuDot / 3413;
+    int newLines = gpuDot / CYCLES_PER_LINE;
     if (newLines == 0) return false;
-    gpuDot %= 3413;
+    gpuDot %= CYCLES_PER_LINE;
     gpuLine += newLines;
 
     if (gpuLine < LINE_VBLANK_START_NTSC - 1) {
@@ -538,6 +865,10 @@ bool GPU::emulateGpuCycles(int cycles) {
     if (gpuLine == LINES_TOTAL_NTSC - 1) {
         gpuLine = 0;
         frames++;
+
+        // Drawing of skipped frame is finished when its result is observed
+        frameSkipped = frameskip > 0 && (frames % (frameskip + 1)) != 0;
+        if (!frameSkipped) endFrame();
         return true;
     }
     return false;
@@ -1,17 +1,41 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
 #include <glm/vec2.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
+#include "hardware_renderer.h"
 #include "psx_color.h"
 #include "registers.h"
-
-const int MAX_ARGS = 32;
+#include "utils/ring_buffer.h"
+#include "vram_dirty.h"
 
 extern const char* CommandStr[];
 
 const int VRAM_WIDTH = 1024;
 const int VRAM_HEIGHT = 512;
 
-#define VRAM ((uint16_t(*)[VRAM_WIDTH])vram.data())
+// Position of pixel in GPU::vram, coordinates must be inside VRAM.
+// With ENABLE_TILED_VRAM pixels are stored in 32x32 tiles (2KB each),
+// so texture fetches walking across rows stay within a few cache lines.
+#ifdef ENABLE_TILED_VRAM
+const int VRAM_TILE_SHIFT = 5;
+const int VRAM_TILE_MASK = (1 << VRAM_TILE_SHIFT) - 1;
+
+inline int vramIndex(int x, int y) {
+    int tile = (y >> VRAM_TILE_SHIFT) * (VRAM_WIDTH >> VRAM_TILE_SHIFT) + (x >> VRAM_TILE_SHIFT);
+    return (tile << (2 * VRAM_TILE_SHIFT)) | ((y & VRAM_TILE_MASK) << VRAM_TILE_SHIFT) | (x & VRAM_TILE_MASK);
+}
+
+// Number of pixels of the row stored contiguously from x
+inline int vramRun(int x) { return VRAM_TILE_MASK + 1 - (x & VRAM_TILE_MASK); }
+#else
+inline int vramIndex(int x, int y) { return y * VRAM_WIDTH + x; }
+
+inline int vramRun(int x) { return VRAM_WIDTH - x; }
+#endif
 
 union PolygonArgs {
     struct {
@@ -26,14 +50,6 @@ union PolygonArgs {
 
     PolygonArgs(uint8_t arg) : _(arg) {}
 
-    int getArgumentCount() const {
-        int size = isQuad ? 4 : 3;
-        if (isTextureMapped) size *= 2;
-        if (gouroudShading) size += (isQuad ? 4 : 3) - 1;
-
-        return size;
-    }
-
     int getVertexCount() const { return isQuad ? 4 : 3; }
 };
 
@@ -49,10 +65,11 @@ union LineArgs {
     uint8_t _;
 
     LineArgs(uint8_t arg) : _(arg) {}
-
-    int getArgumentCount() const { return (polyLine ? MAX_ARGS - 1 : (gouroudShading ? 2 : 1) * 2); }
 };
 
+// Polyline ends with 0x50005000 or 0x55555555, hardware checks only these bits
+inline bool isPolylineTerminator(uint32_t word) { return (word & 0xf000f000) == 0x50005000; }
+
 union RectangleArgs {
     struct {
         uint8_t isRawTexture : 1;
@@ -65,8 +82,6 @@ union RectangleArgs {
 
     RectangleArgs(uint8_t arg) : _(arg) {}
 
-    int getArgumentCount() const { return (size == 0 ? 2 : 1) + (isTextureMapped ? 1 : 0); }
-
     int getSize() const {
         if (size == 1) return 1;
         if (size == 2) return 8;
@@ -96,12 +111,10 @@ struct Vertex {
     int bitcount;
     int clut[2];     // clut position
     int texpage[2];  // texture page position
-    int flags;
-    /**
-     * 0b76543210
-     *          ^
-     *          Transparency enabled (yes for tris, no for rect)
-     */
+    int flags;  // Flags, bits 4-5 hold semi transparency mode (GP0_E1::SemiTransparency)
+
+    static const int TRANSPARENCY_SHIFT = 4;
+    int transparency() const { return (flags >> TRANSPARENCY_SHIFT) & 3; }
 };
 
 struct TextureInfo {
@@ -142,9 +155,51 @@ struct TextureInfo {
         }
     }
 
-    bool isTransparent() const { return (texpage & 0x600000) >> 21; }
+    int getTransparency() const { return (texpage & 0x600000) >> 21; }
 };
 
+// Displayed part of VRAM with display settings, captured at the end of frame
+// so it can be presented independently of emulation
+struct DisplaySnapshot {
+    int16_t displayAreaStartX = 0;
+    int16_t displayAreaStartY = 0;
+    GP1_08 gp1_08;  // resolution and color depth
+    bool fullVram = false;
+    int frameCycles = 0;  // CPU cycles per emulated frame, frames are produced at CPU_CLOCK / frameCycles per second
+
+    // Copied VRAM area, 24 bit modes take 1.5 halfword per pixel
+    int x = 0;
+    int y = 0;
+    int w = 0;
+    int h = 0;
+    std::vector<uint16_t> pixels;
+};
+
+// Fill rate statistics of software renderer for one presented frame,
+// frames dropped by frameskip are counted into the next presented one
+struct FillStats {
+    // Drawing commands before culling, polylines count every segment
+    int polygons = 0;
+    int rectangles = 0;
+    int lines = 0;
+    int fills = 0;
+
+    uint64_t pixelsTested = 0;  // considered by rasterizer (bounding box scan for polygons)
+    uint64_t pixelsWritten = 0;
+    uint64_t pixelsTextured = 0;  // written pixels sampling texture
+    uint64_t pixelsBlended = 0;   // written pixels blended with previous VRAM content
+
+    // Writes per VRAM pixel in linear layout, saturates at 255
+    std::vector<uint8_t> overdraw;
+
+    void clear();
+
+    // Average writes per pixel in cellSize x cellSize blocks, row by row
+    std::vector<float> heatmap(int cellSize) const;
+};
+
+class Rasterizer;
+
 struct GPU {
     /* 0 - nothing
        1 - GP0(0xc0) - VRAM to CPU transfer
@@ -163,11 +218,18 @@ struct GPU {
     uint32_t GPUREAD = 0;
     uint32_t GPUSTAT = 0;
 
+    // GPUSTAT bits changed by GP0 (E1, E6, IRQ, CPU to VRAM transfer), published by thread executing GP0
+    // so polling GPUSTAT doesn't have to wait for queued commands
+    std::atomic<uint32_t> gp0Status{1 << 27};
+    void publishGp0Status();
+
     Command cmd = Command::None;
-    uint8_t command = 0;
-    uint32_t arguments[33];
-    int currentArgument = 0;
-    int argumentCount = 0;
+    std::vector<uint32_t> packet;  // Incomplete GP0 packet, waiting for remaining words
+
+    // Line is drawn from last vertex, polylines continue from it while cmd == Command::Line
+    uint32_t lineVertex = 0;  // GP0 position word
+    RGB lineColor = {};
+    int lineFlags = 0;  // Vertex::Flags
 
     GP0_E1 gp0_e1;
     GP0_E2 gp0_e2;
@@ -214,18 +276,27 @@ struct GPU {
     bool textureDisableAllowed = false;
 
     void reset();
-    void cmdFillRectangle(uint8_t command, uint32_t arguments[]);
-    void cmdPolygon(PolygonArgs arg, uint32_t arguments[]);
-    void cmdLine(LineArgs arg, uint32_t arguments[]);
-    void cmdRectangle(RectangleArgs arg, uint32_t arguments[]);
-    void cmdCpuToVram1(uint8_t command, uint32_t arguments[]);
-    void cmdCpuToVram2(uint8_t command, uint32_t arguments[]);
-    void cmdVramToCpu(uint8_t command, uint32_t arguments[]);
-    void cmdVramToVram(uint8_t command, uint32_t arguments[]);
+    // arguments[0] is the command word
+    void cmdFillRectangle(uint8_t command, const uint32_t arguments[]);
+    void cmdPolygon(uint8_t command, const uint32_t arguments[]);
+    void cmdLine(uint8_t command, const uint32_t arguments[]);
+    void cmdRectangle(uint8_t command, const uint32_t arguments[]);
+    void cmdCpuToVram1(uint8_t command, const uint32_t arguments[]);
+    void cmdVramToCpu(uint8_t command, const uint32_t arguments[]);
+    void cmdVramToVram(uint8_t command, const uint32_t arguments[]);
+    void cmdExtra(uint8_t command, const uint32_t arguments[]);
+
+    // Pixel data of CPU -> VRAM transfer, returns number of words consumed
+    size_t cmdCpuToVram2(const uint32_t* data, size_t count);
+    // Polyline vertices after the first segment, returns number of words consumed
+    size_t cmdPolyLine(const uint32_t* data, size_t count);
+
+    void lineTo(uint32_t vertex, uint32_t color);
 
     void drawPolygon(int16_t x[4], int16_t y[4], RGB c[4], TextureInfo t, bool isFourVertex = false, bool textured = false, int flags = 0);
 
-    void writeGP0(uint32_t data);
+    // GP0 accepts any number of words, packets might be split between calls
+    void writeGP0(const uint32_t* data, size_t count);
     void writeGP1(uint32_t data);
 
     int minDrawingX(int x) const;
@@ -234,21 +305,105 @@ struct GPU {
     int maxDrawingY(int y) const;
     bool insideDrawingArea(int x, int y) const;
 
-    bool odd = false;
+    // In 480 line interlaced mode with drawing to displayed area prohibited
+    // lines of the field being displayed are left untouched.
+    // Returns parity of skipped lines or -1 if all lines are drawn.
+    int skippedField() const;
+
+    // Video timing, NTSC line count is emulated in both video modes
+    static const int CYCLES_PER_LINE = 3413;
+    static const int LINES_TOTAL_NTSC = 263;
+    static const int LINE_VBLANK_START_NTSC = 243;
+
+    // Updated by emulateGpuCycles, read by GPU thread
+    std::atomic<bool> odd{false};
     int frames = 0;
 
-    GPU() {
-        vram.resize(VRAM_WIDTH * VRAM_HEIGHT * resolutionMultiplier);
-        prevVram.resize(VRAM_WIDTH * VRAM_HEIGHT * resolutionMultiplier);
-    }
+    // Number of frames skipped after each presented one
+    int frameskip = 0;
+    // Last emulated frame won't be presented, its drawing might still be pending
+    bool frameSkipped = false;
+
+    // Don't draw frames identical to one still present in VRAM (see Rasterizer::endFrame)
+    bool frameCaching = true;
+    // GP0 packets and drawing state since last presented frame
+    uint64_t frameHash = 0;
+
+    // Collect FillStats of software renderer, takes effect from next presented frame
+    bool fillStatsEnabled = false;
+    FillStats fillStats;  // last presented frame, valid while enabled
+    FillStats frameFillStats;
+    bool collectingFillStats = false;
+
+    GPU();
+    ~GPU();
     void step();
     uint32_t read(uint32_t address);
     void write(uint32_t address, uint32_t data);
 
+    // DMA, GPUREAD and GP0 port
+    void readBlock(uint32_t* data, size_t count);
+    void writeBlock(const uint32_t* data, size_t count);
+
     bool emulateGpuCycles(int cycles);
 
+    // Finish all pending drawing, VRAM is up to date afterwards
+    void flush();
+
+    // Flush at the end of presented frame
+    void endFrame();
+
+    // In threaded mode GP0 words are queued and executed on a separate thread.
+    // Emulation waits for it only when guest reads results of commands (GPUREAD), for GP1 commands and at the end of frame.
+    void setThreaded(bool threaded);
+    bool isThreaded() const { return gpuThread.joinable(); }
+
+    // Wait until all queued GP0 words are executed
+    void sync();
+
+    // Layout depends on build options, access pixels through pixel() and areas through readVram/writeVram
     std::vector<uint16_t> vram;
-    std::vector<uint16_t> prevVram;
+    std::vector<uint16_t> prevVram;  // VRAM at the beginning of frame, used to replay GPU log
+
+    uint16_t& pixel(int x, int y) { return vram.data()[vramIndex(x, y)]; }
+    uint16_t pixel(int x, int y) const { return vram.data()[vramIndex(x, y)]; }
+
+    // Copy area from/to linear buffer of w * h pixels, area must be inside VRAM
+    void readVram(int x, int y, int w, int h, uint16_t* data) const;
+    void writeVram(int x, int y, int w, int h, const uint16_t* data);
+
+    // Every VRAM write is recorded separately for each consumer,
+    // so it can process (and clear) only areas modified since its last visit.
+    // Marks are made when pixels actually land in VRAM, query them after flush().
+    enum class VramConsumer { Renderer, Snapshot, FrameCache, Count };
+    VramDirtyMap vramDirty[(int)VramConsumer::Count];
+
+    void markVramDirty(int x, int y, int w, int h);
+    void markVramDirty(const VramDirtyMap& map);
+    VramDirtyMap takeVramDirty(VramConsumer consumer);
+
+    // Copy areas modified since last snapshot to prevVram
+    void snapshotVram();
+
+    // Copy display area (or whole VRAM) with current display settings, call after flush()
+    void snapshotDisplay(DisplaySnapshot& snapshot, bool fullVram);
+
+    std::unique_ptr<Rasterizer> rasterizer;
+
+    // Set by frontend to draw on host GPU, software rasterizer is bypassed then.
+    // Not compatible with threaded mode, GP0 must be executed on thread owning graphics context.
+    HardwareRenderer* hardwareRenderer = nullptr;
+
+    utils::RingBuffer<uint32_t, 64 * 1024> fifo;
+    uint64_t queuedWords = 0;  // Written only by emulation thread
+    std::atomic<uint64_t> processedWords{0};
+
+    std::thread gpuThread;
+    std::mutex gpuThreadMutex;
+    std::condition_variable gpuThreadWakeUp;
+    std::atomic<bool> gpuThreadSleeping{false};
+    std::atomic<bool> gpuThreadExit{false};
+    void gpuThreadLoop();
 
     struct GPU_LOG_ENTRY {
         uint8_t command;
@@ -12,4 +12,31 @@ int GPU::maxDrawingY(int y) const { return std::min((int)drawingAreaBottom, std:
 bool GPU::insideDrawingArea(int x, int y) const {
     return (x >= drawingAreaLeft) && (x < drawingAreaRight) && (x < VRAM_WIDTH) && (y >= drawingAreaTop) && (y < drawingAreaBottom)
            && (y < VRAM_HEIGHT);
-}
\ No newline at end of file
+}
+
+int GPU::skippedField() const {
+    if (gp1_08.verticalResolution != GP1_08::VerticalResolution::r480 || !gp1_08.interlace) return -1;
+    if (gp0_e1.drawingToDisplayArea == GP0_E1::DrawingToDisplayArea::allowed) return -1;
+    return odd ? 1 : 0;
+}
+
+void FillStats::clear() {
+    polygons = rectangles = lines = fills = 0;
+    pixelsTested = pixelsWritten = pixelsTextured = pixelsBlended = 0;
+    overdraw.assign(VRAM_WIDTH * VRAM_HEIGHT, 0);
+}
+
+std::vector<float> FillStats::heatmap(int cellSize) const {
+    const int cellsX = VRAM_WIDTH / cellSize;
+    const int cellsY = VRAM_HEIGHT / cellSize;
+    std::vector<float> cells(cellsX * cellsY, 0.f);
+    if (overdraw.empty()) return cells;
+
+    for (int y = 0; y < VRAM_HEIGHT; y++) {
+        for (int x = 0; x < VRAM_WIDTH; x++) {
+            cells[(y / cellSize) * cellsX + x / cellSize] += overdraw[y * VRAM_WIDTH + x];
+        }
+    }
+    for (float& cell : cells) cell /= cellSize * cellSize;
+    return cells;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+
+struct GPU;
+struct Vertex;
+union RGB;
+
+/**
+ * Drawing backend executing primitives on host GPU instead of software rasterizer.
+ * VRAM lives in host GPU memory, GPU::vram is written back only when guest reads VRAM
+ * (VRAM to CPU and VRAM to VRAM transfers), so it is stale for drawn areas otherwise.
+ *
+ * Methods are called from thread executing GP0 commands, which must own the graphics context.
+ */
+class HardwareRenderer {
+   public:
+    virtual ~HardwareRenderer() = default;
+
+    // Vertex positions are relative to drawing offset, drawing state is taken from gpu
+    virtual void drawTriangle(GPU* gpu, const Vertex v[3]) = 0;
+    // flags are Vertex::Flags
+    virtual void drawLine(GPU* gpu, const int16_t x[2], const int16_t y[2], const RGB c[2], int flags) = 0;
+
+    // Area is already clipped, offset and semi transparency don't apply
+    virtual void fill(int x, int y, int w, int h, uint16_t color) = 0;
+
+    // Area of GPU::vram was written directly (CPU to VRAM transfer), coordinates wrap around
+    virtual void vramWritten(GPU* gpu, int x, int y, int w, int h) = 0;
+
+    // Copy area to GPU::vram before it is read, coordinates wrap around
+    virtual void vramRead(GPU* gpu, int x, int y, int w, int h) = 0;
+
+    // Execute all batched drawing
+    virtual void flush() = 0;
+};
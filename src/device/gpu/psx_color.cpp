@@ -0,0 +1,28 @@
+#include "psx_color.h"
+
+// clang-format off
+static const int ditherTable[4][4] = {
+    {-4, +0, -3, +1},
+    {+2, -2, +3, -1},
+    {-3, +1, -4, +0},
+    {+3, -1, +2, -2}
+};
+// clang-format on
+
+ColorLut::ColorLut() {
+    for (int brightness = 0; brightness < 256; brightness++) {
+        for (int texel = 0; texel < 32; texel++) {
+            modulate[brightness][texel] = std::min((texel * brightness) >> 7, 31);
+        }
+    }
+
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            for (int c = 0; c < 256; c++) {
+                dither[y][x][c] = clamp(c + ditherTable[y][x], 0, 255) >> 3;
+            }
+        }
+    }
+}
+
+const ColorLut colorLut;
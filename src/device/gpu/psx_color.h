@@ -47,39 +47,90 @@ union PSXColor {
 
     PSXColor() : _(0) {}
     PSXColor(uint16_t color) : _(color) {}
+};
 
-    PSXColor operator+(const PSXColor& rhs) {
-        r = std::min(r + rhs.r, 31);
-        g = std::min(g + rhs.g, 31);
-        b = std::min(b + rhs.b, 31);
-        return *this;
-    }
+// Integer color pipeline
+// Tables are generated once at startup (psx_color.cpp)
+struct ColorLut {
+    // modulate[brightness][texel] = min(texel * brightness / 128, 31)
+    uint8_t modulate[256][32];
 
-    PSXColor operator-(const PSXColor& rhs) {
-        r = std::max<int>(r - rhs.r, 0);
-        g = std::max<int>(g - rhs.g, 0);
-        b = std::max<int>(b - rhs.b, 0);
-        return *this;
-    }
+    // dither[y % 4][x % 4][c] = clamp(c + ditherTable[y % 4][x % 4], 0, 255) >> 3
+    uint8_t dither[4][4][256];
 
-    PSXColor operator*(const float& rhs) {
-        r = (uint16_t)(r * rhs);
-        g = (uint16_t)(g * rhs);
-        b = (uint16_t)(b * rhs);
-        return *this;
-    }
+    ColorLut();
+};
 
-    PSXColor operator/(const float& rhs) {
-        r = (uint16_t)(r / rhs);
-        g = (uint16_t)(g / rhs);
-        b = (uint16_t)(b / rhs);
-        return *this;
-    }
+extern const ColorLut colorLut;
+
+// Modulate 15bit texel by 24bit brightness (0x80 - no change)
+inline uint16_t modulate(uint16_t texel, uint8_t r, uint8_t g, uint8_t b) {
+    return (texel & 0x8000)                                  //
+           | colorLut.modulate[r][texel & 0x1f]              //
+           | colorLut.modulate[g][(texel >> 5) & 0x1f] << 5  //
+           | colorLut.modulate[b][(texel >> 10) & 0x1f] << 10;
+}
+
+// Convert 24bit color to 15bit with ordered dithering, row is y % 4, column is x % 4
+inline uint16_t dither15bit(uint8_t r, uint8_t g, uint8_t b, int row, int column) {
+    const uint8_t* lut = colorLut.dither[row][column];
+    return lut[r] | lut[g] << 5 | lut[b] << 10;
+}
 
-    PSXColor operator*(const glm::vec3& rhs) {
-        r = std::min<uint16_t>((uint16_t)(rhs.r * r), 31);
-        g = std::min<uint16_t>((uint16_t)(rhs.g * g), 31);
-        b = std::min<uint16_t>((uint16_t)(rhs.b * b), 31);
-        return *this;
+/**
+ * Semi-transparency blending on packed pixels.
+ * Every channel is 5bit wide, carries/borrows are handled per channel (SWAR),
+ * so one 32bit operation blends two 15bit pixels at once (bit 15 of each pixel is ignored,
+ * caller is responsible for mask bit).
+ */
+namespace blend {
+const uint32_t LSB_MASK = 0x04210421;   // bit 0 of every channel
+const uint32_t MSB_MASK = 0x42104210;   // bit 4 of every channel
+const uint32_t LOW_MASK = 0x3def3def;   // bits 0-3 of every channel
+const uint32_t HIGH_MASK = 0x7bde7bde;  // bits 1-4 of every channel
+const uint32_t RGB_MASK = 0x7fff7fff;
+
+// Channels with carry/borrow flag (bit 4 position) set -> 0x1f
+inline uint32_t expandFlags(uint32_t flags) {
+    uint32_t lsb = flags >> 4;
+    return (lsb << 5) - lsb;
+}
+
+// min(B + F, 31)
+inline uint32_t add(uint32_t b, uint32_t f) {
+    uint32_t low = (b & LOW_MASK) + (f & LOW_MASK);
+    uint32_t sum = low ^ ((b ^ f) & MSB_MASK);
+    uint32_t carry = ((b & f) | ((b ^ f) & low)) & MSB_MASK;
+    return (sum | expandFlags(carry)) & RGB_MASK;
+}
+
+// max(B - F, 0)
+inline uint32_t sub(uint32_t b, uint32_t f) {
+    uint32_t low = ((b & LOW_MASK) | MSB_MASK) - (f & LOW_MASK);
+    uint32_t diff = (low & LOW_MASK) | ((b ^ f ^ ~low) & MSB_MASK);
+    uint32_t borrow = ((~b & f) | (~(b ^ f) & ~low)) & MSB_MASK;
+    return diff & ~expandFlags(borrow) & RGB_MASK;
+}
+
+// B / 2 + F / 2
+inline uint32_t average(uint32_t b, uint32_t f) { return ((b & f) + (((b ^ f) & HIGH_MASK) >> 1)) & RGB_MASK; }
+
+// min(B + F / 4, 31)
+inline uint32_t addQuarter(uint32_t b, uint32_t f) { return add(b, (f >> 2) & (LOW_MASK & ~(LSB_MASK << 3))); }
+
+// mode is GP0_E1::SemiTransparency
+inline uint32_t pixels(uint32_t b, uint32_t f, int mode) {
+    switch (mode) {
+        case 0:
+            return average(b, f);
+        case 1:
+            return add(b, f);
+        case 2:
+            return sub(b, f);
+        case 3:
+            return addQuarter(b, f);
+        default:
+            return f;
     }
-};
\ No newline at end of file
+}
+}  // namespace blend
@@ -0,0 +1,346 @@
+#include "rasterizer.h"
+#include <algorithm>
+
+namespace {
+bool overlaps(const Primitive& p, glm::ivec2 min, glm::ivec2 max) {
+    return p.min.x < max.x && min.x < p.max.x && p.min.y < max.y && min.y < p.max.y;
+}
+
+bool coversTile(const Primitive& p, int tileX, int tileY) {
+    if (p.skippedField >= 0) return false;  // lines of other field are preserved
+    int x = tileX * Rasterizer::TILE_SIZE;
+    int y = tileY * Rasterizer::TILE_SIZE;
+    return p.min.x <= x && p.min.y <= y && p.max.x >= x + Rasterizer::TILE_SIZE && p.max.y >= y + Rasterizer::TILE_SIZE;
+}
+
+// Area of VRAM transfer, whole rows/columns if it wraps around VRAM edge
+void transferArea(int x, int y, int w, int h, glm::ivec2& min, glm::ivec2& max) {
+    x %= VRAM_WIDTH;
+    y %= VRAM_HEIGHT;
+    w = std::max(w, 1);
+    h = std::max(h, 1);
+
+    min = glm::ivec2(x, y);
+    max = glm::ivec2(x + w, y + h);
+    if (max.x > VRAM_WIDTH) {
+        min.x = 0;
+        max.x = VRAM_WIDTH;
+    }
+    if (max.y > VRAM_HEIGHT) {
+        min.y = 0;
+        max.y = VRAM_HEIGHT;
+    }
+}
+
+// Splits area wrapping around VRAM edges (as texture and palette addressing does) into up to four rectangles
+template <typename F>
+void forEachWrappedArea(glm::ivec2 min, glm::ivec2 max, F fn) {
+    int x = min.x & (VRAM_WIDTH - 1);
+    int y = min.y & (VRAM_HEIGHT - 1);
+    int w = std::min(max.x - min.x, VRAM_WIDTH);
+    int h = std::min(max.y - min.y, VRAM_HEIGHT);
+    if (w <= 0 || h <= 0) return;
+
+    int w0 = std::min(w, VRAM_WIDTH - x);
+    int h0 = std::min(h, VRAM_HEIGHT - y);
+    fn(glm::ivec2(x, y), glm::ivec2(x + w0, y + h0));
+    if (w0 < w) fn(glm::ivec2(0, y), glm::ivec2(w - w0, y + h0));
+    if (h0 < h) fn(glm::ivec2(x, 0), glm::ivec2(x + w0, h - h0));
+    if (w0 < w && h0 < h) fn(glm::ivec2(0, 0), glm::ivec2(w - w0, h - h0));
+}
+}  // namespace
+
+Rasterizer::Rasterizer(GPU* gpu, int threads) : gpu(gpu), nextTile(0) {
+    primitives.reserve(MAX_PRIMITIVES);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(&Rasterizer::worker, this);
+    }
+}
+
+Rasterizer::~Rasterizer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wakeUp.notify_all();
+    for (auto& w : workers) w.join();
+}
+
+void Rasterizer::submit(const Primitive& p) {
+    if (p.min.x >= p.max.x || p.min.y >= p.max.y) return;
+    if (primitives.size() >= MAX_PRIMITIVES) flush();
+
+    // Earlier primitive in the batch samples area this one draws to
+    if (!primitives.empty() && touches(sampled, p.min, p.max)) flush();
+
+    // Result would depend on VRAM content from before the frame
+    if (p.skippedField >= 0) frameCacheable = false;
+    if ((p.flags & Vertex::SemiTransparency) && !coveredByFill(p.min, p.max)) frameCacheable = false;
+
+    if (p.bits != 0) {
+        // Texture page (texcoords might exceed 255 for rectangles)
+        int maxU = 255, maxV = 255;
+        for (int i = 0; i < 3; i++) {
+            maxU = std::max(maxU, p.tex[i].x);
+            maxV = std::max(maxV, p.tex[i].y);
+        }
+        int texelsPerPixel = 16 / p.bits;
+        glm::ivec2 texMax = p.texPage + glm::ivec2(maxU / texelsPerPixel + 1, maxV + 1);
+
+        // Palette
+        glm::ivec2 clutMax = p.clut + glm::ivec2(p.bits != 16 ? 1 << p.bits : 0, 1);
+
+        bool samplesItself = false;
+        auto checkSampled = [&](glm::ivec2 min, glm::ivec2 max) {
+            flushIfDirty(min, max);
+            samplesItself = samplesItself || overlaps(p, min, max);
+        };
+        forEachWrappedArea(p.texPage, texMax, checkSampled);
+        if (p.bits != 16) forEachWrappedArea(p.clut, clutMax, checkSampled);
+
+        // Primitive samples area it draws to - result depends on drawing order,
+        // draw it immediately in scanline order
+        if (samplesItself) {
+            flush();
+            PixelStats pixels;
+            if (stats) pixels.overdraw = stats->overdraw.data();
+            rasterizeTriangle(gpu, p, glm::ivec2(0, 0), glm::ivec2(VRAM_WIDTH, VRAM_HEIGHT), stats ? &pixels : nullptr);
+            if (stats) addStats(pixels);
+            gpu->markVramDirty(p.min.x, p.min.y, p.max.x - p.min.x, p.max.y - p.min.y);
+            frameComplete = false;
+            return;
+        }
+
+        auto markSampled = [&](glm::ivec2 min, glm::ivec2 max) { mark(sampled, min, max); };
+        forEachWrappedArea(p.texPage, texMax, markSampled);
+        sampledArea.mark(p.texPage.x, p.texPage.y, texMax.x - p.texPage.x, texMax.y - p.texPage.y);
+        if (p.bits != 16) {
+            forEachWrappedArea(p.clut, clutMax, markSampled);
+            sampledArea.mark(p.clut.x, p.clut.y, clutMax.x - p.clut.x, 1);
+        }
+    }
+
+    uint32_t index = primitives.size();
+    primitives.push_back(p);
+    if (p.type == Primitive::Type::Fill) fills.push_back(index);
+    written.mark(p.min.x, p.min.y, p.max.x - p.min.x, p.max.y - p.min.y);
+
+    int tileMinX = p.min.x / TILE_SIZE;
+    int tileMinY = p.min.y / TILE_SIZE;
+    int tileMaxX = (p.max.x - 1) / TILE_SIZE;
+    int tileMaxY = (p.max.y - 1) / TILE_SIZE;
+    for (int y = tileMinY; y <= tileMaxY; y++) {
+        for (int x = tileMinX; x <= tileMaxX; x++) {
+            int tile = y * TILES_X + x;
+            if (!dirty[tile]) activeTiles.push_back(tile);
+
+            // Fill overwrites whole tile - nothing drawn earlier in it is visible anymore.
+            // Primitives sampling this tile were flushed above, so pending ones can be dropped.
+            if (p.type == Primitive::Type::Fill && coversTile(p, x, y)) bins[tile].clear();
+
+            bins[tile].push_back(index);
+            dirty[tile] = true;
+        }
+    }
+}
+
+bool Rasterizer::touches(const bool* tiles, glm::ivec2 min, glm::ivec2 max) const {
+    int tileMinX = std::max(0, min.x / TILE_SIZE);
+    int tileMinY = std::max(0, min.y / TILE_SIZE);
+    int tileMaxX = std::min(TILES_X - 1, (max.x - 1) / TILE_SIZE);
+    int tileMaxY = std::min(TILES_Y - 1, (max.y - 1) / TILE_SIZE);
+    for (int y = tileMinY; y <= tileMaxY; y++) {
+        for (int x = tileMinX; x <= tileMaxX; x++) {
+            if (tiles[y * TILES_X + x]) return true;
+        }
+    }
+    return false;
+}
+
+void Rasterizer::mark(bool* tiles, glm::ivec2 min, glm::ivec2 max) {
+    int tileMinX = std::max(0, min.x / TILE_SIZE);
+    int tileMinY = std::max(0, min.y / TILE_SIZE);
+    int tileMaxX = std::min(TILES_X - 1, (max.x - 1) / TILE_SIZE);
+    int tileMaxY = std::min(TILES_Y - 1, (max.y - 1) / TILE_SIZE);
+    for (int y = tileMinY; y <= tileMaxY; y++) {
+        for (int x = tileMinX; x <= tileMaxX; x++) {
+            tiles[y * TILES_X + x] = true;
+        }
+    }
+}
+
+// Area was overwritten by fill earlier in the batch
+bool Rasterizer::coveredByFill(glm::ivec2 min, glm::ivec2 max) const {
+    for (uint32_t index : fills) {
+        const Primitive& fill = primitives[index];
+        if (fill.skippedField < 0 && fill.min.x <= min.x && fill.min.y <= min.y && fill.max.x >= max.x && fill.max.y >= max.y) return true;
+    }
+    return false;
+}
+
+void Rasterizer::flushIfDirty(glm::ivec2 min, glm::ivec2 max) {
+    if (!primitives.empty() && touches(dirty, min, max)) flush();
+}
+
+void Rasterizer::flushForRead(int x, int y, int w, int h) {
+    if (primitives.empty()) return;
+
+    glm::ivec2 min, max;
+    transferArea(x, y, w, h, min, max);
+    if (touches(dirty, min, max)) flush();
+}
+
+void Rasterizer::flushForWrite(int x, int y, int w, int h) {
+    if (primitives.empty()) return;
+
+    glm::ivec2 min, max;
+    transferArea(x, y, w, h, min, max);
+    if (touches(dirty, min, max) || touches(sampled, min, max)) flush();
+}
+
+void Rasterizer::flush() {
+    if (primitives.empty()) return;
+    frameComplete = false;
+
+    nextTile = 0;
+    if (workers.empty() || activeTiles.size() == 1) {
+        renderTiles();
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers = workers.size();
+            generation++;
+        }
+        wakeUp.notify_all();
+        renderTiles();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+    }
+
+    gpu->markVramDirty(written);
+    if (stats) {
+        for (int tile : activeTiles) addStats(tileStats[tile]);
+    }
+    clearBatch();
+}
+
+void Rasterizer::setStats(FillStats* stats) {
+    this->stats = stats;
+    for (auto& pixels : tileStats) pixels = PixelStats();
+    if (stats) {
+        for (auto& pixels : tileStats) pixels.overdraw = stats->overdraw.data();
+    }
+}
+
+void Rasterizer::addStats(PixelStats& pixels) {
+    stats->pixelsTested += pixels.tested;
+    stats->pixelsWritten += pixels.written;
+    stats->pixelsTextured += pixels.textured;
+    stats->pixelsBlended += pixels.blended;
+    pixels.tested = pixels.written = pixels.textured = pixels.blended = 0;
+}
+
+void Rasterizer::endFrame(uint64_t hash, bool skipIdentical) {
+    // Cached frames are invalidated by any write to areas they depend on
+    auto invalidate = [this](const VramDirtyMap& modified) {
+        for (auto& frame : cache) {
+            if (frame.valid && frame.area.intersects(modified)) frame.valid = false;
+        }
+    };
+    invalidate(gpu->takeVramDirty(GPU::VramConsumer::FrameCache));
+
+    bool cacheable = frameComplete && frameCacheable && !primitives.empty() && !written.intersects(sampledArea);
+    frameComplete = true;
+    frameCacheable = true;
+
+    if (cacheable && skipIdentical) {
+        for (auto& frame : cache) {
+            if (frame.valid && frame.hash == hash) {
+                clearBatch();
+                return;
+            }
+        }
+    }
+
+    VramDirtyMap area = written;
+    area.merge(sampledArea);
+
+    flush();
+    frameComplete = true;
+    invalidate(gpu->takeVramDirty(GPU::VramConsumer::FrameCache));
+    if (!cacheable) return;
+
+    // Reuse entry of the same frame or an invalid one, the oldest otherwise
+    int index = nextCachedFrame;
+    for (int i = 0; i < CACHED_FRAMES; i++) {
+        if (cache[i].hash == hash || !cache[i].valid) {
+            index = i;
+            break;
+        }
+    }
+    if (index == nextCachedFrame) nextCachedFrame = (nextCachedFrame + 1) % CACHED_FRAMES;
+
+    cache[index].valid = true;
+    cache[index].hash = hash;
+    cache[index].area = area;
+}
+
+void Rasterizer::clearBatch() {
+    for (int tile : activeTiles) {
+        bins[tile].clear();
+        dirty[tile] = false;
+    }
+    activeTiles.clear();
+    std::fill(std::begin(sampled), std::end(sampled), false);
+    primitives.clear();
+    fills.clear();
+    written.clear();
+    sampledArea.clear();
+}
+
+void Rasterizer::worker() {
+    int lastGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [&] { return quit || generation != lastGeneration; });
+            if (quit) return;
+            lastGeneration = generation;
+        }
+
+        renderTiles();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) done.notify_one();
+    }
+}
+
+void Rasterizer::renderTiles() {
+    for (;;) {
+        size_t i = nextTile++;
+        if (i >= activeTiles.size()) return;
+        renderTile(activeTiles[i]);
+    }
+}
+
+void Rasterizer::renderTile(int tile) {
+    glm::ivec2 clipMin = glm::ivec2((tile % TILES_X) * TILE_SIZE, (tile / TILES_X) * TILE_SIZE);
+    glm::ivec2 clipMax = clipMin + glm::ivec2(TILE_SIZE, TILE_SIZE);
+
+    PixelStats* pixels = stats ? &tileStats[tile] : nullptr;
+    for (uint32_t index : bins[tile]) {
+        const Primitive& p = primitives[index];
+        switch (p.type) {
+            case Primitive::Type::Triangle:
+                rasterizeTriangle(gpu, p, clipMin, clipMax, pixels);
+                break;
+            case Primitive::Type::Line:
+                rasterizeLine(gpu, p, clipMin, clipMax, pixels);
+                break;
+            case Primitive::Type::Fill:
+                rasterizeFill(gpu, p, clipMin, clipMax, pixels);
+                break;
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "render.h"
+
+/**
+ * Tile based (binning) rasterizer.
+ * Submitted primitives are recorded into per-tile bins and drawn on flush,
+ * tiles are distributed between worker threads (and the calling thread).
+ *
+ * Each tile is processed by a single thread in submission order,
+ * so overlapping primitives are drawn exactly as they would be without batching.
+ * Textured primitives sampling an area written earlier in the batch flush it first,
+ * as do primitives drawing to an area sampled earlier in the batch.
+ *
+ * Pending primitives are drawn only when their result is observed,
+ * batch might span multiple frames when frames are skipped.
+ * Fills covering whole tile drop primitives pending in it.
+ * Areas they write are reported to GPU as modified only once they are drawn.
+ *
+ * Optional fill rate statistics are counted per tile and summed into FillStats after each flush.
+ *
+ * Menus and static scenes draw the same frame over and over. If whole frame is still pending
+ * when it ends and an identical one (same GP0 commands) was drawn before, pending primitives
+ * are dropped as long as nothing wrote to areas that frame has drawn or sampled since.
+ */
+class Rasterizer {
+   public:
+    static const int TILE_SIZE = 64;
+    static const int TILES_X = VRAM_WIDTH / TILE_SIZE;
+    static const int TILES_Y = VRAM_HEIGHT / TILE_SIZE;
+    static const int TILE_COUNT = TILES_X * TILES_Y;
+    static const size_t MAX_PRIMITIVES = 4096;
+    static const int CACHED_FRAMES = 4;
+
+    Rasterizer(GPU* gpu, int threads);
+    ~Rasterizer();
+
+    void submit(const Primitive& p);
+
+    // Draw all pending primitives, VRAM is up to date afterwards
+    void flush();
+
+    // Flush only if pending primitives write to given area (max is exclusive)
+    void flushIfDirty(glm::ivec2 min, glm::ivec2 max);
+
+    // Flush before VRAM transfer reads/writes given area directly (coordinates wrap around)
+    void flushForRead(int x, int y, int w, int h);
+    void flushForWrite(int x, int y, int w, int h);
+
+    // Draw pending primitives at the end of presented frame, or drop them if identical frame is
+    // already in VRAM (and skipIdentical is set). hash identifies GP0 commands of the frame.
+    void endFrame(uint64_t hash, bool skipIdentical);
+
+    bool empty() const { return primitives.empty(); }
+
+    // Count drawn pixels into stats (nullptr disables), its overdraw map must cover whole VRAM
+    void setStats(FillStats* stats);
+
+   private:
+    GPU* gpu;
+
+    std::vector<Primitive> primitives;
+    std::vector<uint32_t> fills;  // indices of pending fills
+    std::vector<uint32_t> bins[TILE_COUNT];
+    std::vector<int> activeTiles;  // dirty tiles
+    bool dirty[TILE_COUNT] = {};    // written by pending primitives
+    bool sampled[TILE_COUNT] = {};  // read as texture or palette by pending primitives
+    VramDirtyMap written;           // areas drawn by pending primitives
+    VramDirtyMap sampledArea;       // areas read as texture or palette by pending primitives
+
+    // Frames which can be redrawn by keeping VRAM as it is, until areas they drew or sampled are modified
+    struct CachedFrame {
+        bool valid = false;
+        uint64_t hash = 0;
+        VramDirtyMap area;
+    };
+    CachedFrame cache[CACHED_FRAMES];
+    int nextCachedFrame = 0;
+    bool frameComplete = true;   // nothing was drawn since last endFrame except pending primitives
+    bool frameCacheable = true;  // result of pending primitives doesn't depend on previous VRAM content
+
+    FillStats* stats = nullptr;
+    PixelStats tileStats[TILE_COUNT];  // written only by thread rendering the tile
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable done;
+    std::atomic<int> nextTile;
+    int generation = 0;
+    int busyWorkers = 0;
+    bool quit = false;
+
+    bool touches(const bool* tiles, glm::ivec2 min, glm::ivec2 max) const;
+    void mark(bool* tiles, glm::ivec2 min, glm::ivec2 max);
+    bool coveredByFill(glm::ivec2 min, glm::ivec2 max) const;
+    void clearBatch();
+    void addStats(PixelStats& pixels);
+
+    void worker();
+    void renderTiles();
+    void renderTile(int tile);
+};
@@ -1,5 +1,74 @@
 #pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
 #include "gpu.h"
 
-void drawLine(GPU* gpu, const int16_t x[2], const int16_t y[2], const RGB c[2]);
-void drawTriangle(GPU* gpu, Vertex v[3]);
\ No newline at end of file
+// GPU silently drops primitives with vertices further apart than this
+const int MAX_PRIMITIVE_WIDTH = 1023;
+const int MAX_PRIMITIVE_HEIGHT = 511;
+
+// Drawing command with GPU state captured at submission time.
+// Rasterization is deferred (see rasterizer.h) so it must not depend on current GPU registers.
+struct Primitive {
+    enum class Type { Triangle, Line, Fill };
+    Type type;
+
+    // Bounding box clipped to drawing area, max is exclusive
+    glm::ivec2 min;
+    glm::ivec2 max;
+
+    glm::ivec2 pos[3];  // drawing offset already applied
+    glm::ivec3 color[3];
+    glm::ivec2 tex[3];
+    glm::ivec2 texPage;
+    glm::ivec2 clut;
+    int bits;
+    int flags;
+    int transparency;  // semi transparency mode (GP0_E1::SemiTransparency)
+    GP0_E2 textureWindow;
+
+    uint16_t flatColor;  // 15bit color for fills
+    int skippedField;    // lines with (y & 1) == skippedField are not drawn, -1 draws all (see GPU::skippedField)
+};
+
+// Pixel counters of rasterized area (see FillStats), nullptr when not collected.
+// Each tile has its own, overdraw is shared as tiles don't overlap.
+struct PixelStats {
+    uint64_t tested = 0;
+    uint64_t written = 0;
+    uint64_t textured = 0;
+    uint64_t blended = 0;
+    uint8_t* overdraw = nullptr;
+
+    void write(int x, int y, bool texture, bool blend) {
+        written++;
+        textured += texture;
+        blended += blend;
+        uint8_t& count = overdraw[y * VRAM_WIDTH + x];
+        if (count != UINT8_MAX) count++;
+    }
+};
+
+// Last stage of pixel pipeline shared by polygons and lines
+inline void putPixel(uint16_t& pixel, PSXColor c, bool semiTransparent, int transparency) {
+    if (semiTransparent) c._ = (c._ & 0x8000) | blend::pixels(pixel, c._, transparency);
+    pixel = c._;
+}
+
+// Two semi transparent pixels blended by one SWAR operation, same result as two putPixel calls
+inline void putPixelPair(uint16_t& pixel0, PSXColor c0, uint16_t& pixel1, PSXColor c1, int transparency) {
+    uint32_t b = pixel0 | (uint32_t)pixel1 << 16;
+    uint32_t f = c0._ | (uint32_t)c1._ << 16;
+    uint32_t result = (f & 0x80008000) | blend::pixels(b, f, transparency);
+    pixel0 = (uint16_t)result;
+    pixel1 = (uint16_t)(result >> 16);
+}
+
+// flags are Vertex::Flags
+void drawLine(GPU* gpu, const int16_t x[2], const int16_t y[2], const RGB c[2], int flags);
+void drawTriangle(GPU* gpu, Vertex v[3]);
+
+// Draw part of primitive that lies inside [clipMin, clipMax) rectangle
+void rasterizeLine(GPU* gpu, const Primitive& p, glm::ivec2 clipMin, glm::ivec2 clipMax, PixelStats* stats);
+void rasterizeTriangle(GPU* gpu, const Primitive& p, glm::ivec2 clipMin, glm::ivec2 clipMax, PixelStats* stats);
+void rasterizeFill(GPU* gpu, const Primitive& p, glm::ivec2 clipMin, glm::ivec2 clipMax, PixelStats* stats);
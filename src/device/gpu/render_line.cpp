@@ -1,41 +1,100 @@
 #include <algorithm>
+#include "rasterizer.h"
 #include "render.h"
 
-#undef VRAM
-#define VRAM ((uint16_t(*)[VRAM_WIDTH])gpu->vram.data())
+namespace {
+// Integer division rounding towards negative infinity
+int64_t floorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+int64_t ceilDiv(int64_t a, int64_t b) { return -floorDiv(-a, b); }
+
+// Narrow [first, last] to steps i for which (start + i * step) >> 16 lies in [min, max)
+void clipSteps(int64_t start, int64_t step, int min, int max, int& first, int& last) {
+    int64_t lo = (int64_t)min << 16;
+    int64_t hi = ((int64_t)max << 16) - 1;
+
+    if (step == 0) {
+        if (start < lo || start > hi) last = first - 1;
+    } else if (step > 0) {
+        first = (int)std::max<int64_t>(first, ceilDiv(lo - start, step));
+        last = (int)std::min<int64_t>(last, floorDiv(hi - start, step));
+    } else {
+        first = (int)std::max<int64_t>(first, ceilDiv(hi - start, step));
+        last = (int)std::min<int64_t>(last, floorDiv(lo - start, step));
+    }
+}
+}  // namespace
+
+void rasterizeLine(GPU* gpu, const Primitive& p, glm::ivec2 clipMin, glm::ivec2 clipMax, PixelStats* stats) {
+    glm::ivec2 min = glm::ivec2(std::max(p.min.x, clipMin.x), std::max(p.min.y, clipMin.y));
+    glm::ivec2 max = glm::ivec2(std::min(p.max.x, clipMax.x), std::min(p.max.y, clipMax.y));
+    if (min.x >= max.x || min.y >= max.y) return;
+
+    // DDA in 16.16 fixed point, one pixel per step along major axis.
+    // Positions are rounded to nearest pixel, so steps land exactly on both endpoints.
+    glm::ivec2 delta = p.pos[1] - p.pos[0];
+    int steps = std::max(std::abs(delta.x), std::abs(delta.y));
+    int divisor = std::max(steps, 1);
+
+    glm::ivec2 pos = p.pos[0] * 0x10000 + 0x8000;
+    glm::ivec2 posStep = delta * 0x10000 / divisor;
 
-void drawLine(GPU* gpu, const int16_t x[2], const int16_t y[2], const RGB c[2]) {
-    int x0 = x[0] + gpu->drawingOffsetX;
-    int y0 = y[0] + gpu->drawingOffsetY;
-    int x1 = x[1] + gpu->drawingOffsetX;
-    int y1 = y[1] + gpu->drawingOffsetY;
+    // Clip against drawing area/tile before stepping instead of testing every pixel
+    int first = 0;
+    int last = steps;
+    clipSteps(pos.x, posStep.x, min.x, max.x, first, last);
+    clipSteps(pos.y, posStep.y, min.y, max.y, first, last);
+    if (first > last) return;
+    if (stats) stats->tested += last - first + 1;
 
-    bool steep = false;
-    if (std::abs(x0 - x1) < std::abs(y0 - y1)) {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-        steep = true;
+    const bool gouraud = p.flags & Vertex::GouroudShading;
+    const bool dithering = gouraud && (p.flags & Vertex::Dithering);
+    const bool semiTransparent = p.flags & Vertex::SemiTransparency;
+
+    glm::ivec3 color = p.color[0] * 0x10000 + 0x8000;
+    glm::ivec3 colorStep = gouraud ? (p.color[1] - p.color[0]) * 0x10000 / divisor : glm::ivec3(0);
+
+    pos += posStep * first;
+    color += colorStep * first;
+    for (int i = first; i <= last; i++, pos += posStep, color += colorStep) {
+        int x = pos.x >> 16;
+        int y = pos.y >> 16;
+        if ((y & 1) == p.skippedField) continue;
+
+        glm::ivec3 shade = color >> 16;
+        PSXColor c = dithering ? dither15bit(shade.r, shade.g, shade.b, y & 3, x & 3) : to15bit(shade.r, shade.g, shade.b);
+        putPixel(gpu->pixel(x, y), c, semiTransparent, p.transparency);
+        if (stats) stats->write(x, y, false, semiTransparent);
     }
-    if (x0 > x1) {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
+}
+
+void drawLine(GPU* gpu, const int16_t x[2], const int16_t y[2], const RGB c[2], int flags) {
+    Primitive p = {};
+    for (int i = 0; i < 2; i++) {
+        p.pos[i] = glm::ivec2(x[i] + gpu->drawingOffsetX, y[i] + gpu->drawingOffsetY);
     }
+    if (std::abs(p.pos[1].x - p.pos[0].x) > MAX_PRIMITIVE_WIDTH || std::abs(p.pos[1].y - p.pos[0].y) > MAX_PRIMITIVE_HEIGHT) return;
 
-    int dx = x1 - x0;
-    int dy = y1 - y0;
-    int derror = std::abs(dy) * 2;
-    int error = 0;
-    int _y = y0;
-    for (int _x = x0; _x <= x1; _x++) {
-        if (steep) {
-            if (gpu->insideDrawingArea(_y, _x)) VRAM[_x][_y] = to15bit(c[0].c);
-        } else {
-            if (gpu->insideDrawingArea(_x, _y)) VRAM[_y][_x] = to15bit(c[0].c);
-        }
-        error += derror;
-        if (error > dx) {
-            _y += (y1 > y0 ? 1 : -1);
-            error -= dx * 2;
-        }
+    p.min = glm::ivec2(gpu->minDrawingX(std::min(p.pos[0].x, p.pos[1].x)), gpu->minDrawingY(std::min(p.pos[0].y, p.pos[1].y)));
+    p.max = glm::ivec2(gpu->maxDrawingX(std::max(p.pos[0].x, p.pos[1].x) + 1), gpu->maxDrawingY(std::max(p.pos[0].y, p.pos[1].y) + 1));
+    if (p.min.x >= p.max.x || p.min.y >= p.max.y) return;
+
+    if (gpu->hardwareRenderer) {
+        gpu->hardwareRenderer->drawLine(gpu, x, y, c, flags);
+        return;
+    }
+
+    p.type = Primitive::Type::Line;
+    for (int i = 0; i < 2; i++) {
+        p.color[i] = glm::ivec3(c[i].r, c[i].g, c[i].b);
     }
+    p.flags = flags;
+    p.transparency = (int)gpu->gp0_e1.semiTransparency;
+    p.skippedField = gpu->skippedField();
+
+    gpu->rasterizer->submit(p);
 }
@@ -1,36 +1,38 @@
 #include <algorithm>
 #include <glm/glm.hpp>
 #include "psx_color.h"
+#include "rasterizer.h"
 #include "render.h"
 #include "texture_utils.h"
 #include "utils/macros.h"
 
-#undef VRAM
-#define VRAM ((uint16_t(*)[VRAM_WIDTH])gpu->vram.data())
-
-// clang-format off
-int ditherTable[4][4] = {
-    {-4, +0, -3, +1}, 
-    {+2, -2, +3, -1}, 
-    {-3, +1, -4, +0}, 
-    {+3, -1, +2, -2}
-};
-// clang-format on
-
 int orient2d(const glm::ivec2& a, const glm::ivec2& b, const glm::ivec2& c) {
     return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
 }
 
-bool isCw(const glm::ivec2 v[3]) {
-    glm::vec3 a = glm::vec3(v[0].x, v[0].y, 1);
-    glm::vec3 b = glm::vec3(v[1].x, v[1].y, 1);
-    glm::vec3 c = glm::vec3(v[2].x, v[2].y, 1);
+// Primitive setup, done once before triangle reaches any renderer.
+// Applies drawing offset, computes bounding box clipped to drawing area and orders vertices counter clockwise.
+// Returns false for triangles that can't produce any pixels or that GPU refuses to draw.
+bool setupTriangle(GPU* gpu, Vertex v[3], Primitive& p) {
+    for (int j = 0; j < 3; j++) {
+        p.pos[j] = glm::ivec2(v[j].position[0] + gpu->drawingOffsetX, v[j].position[1] + gpu->drawingOffsetY);
+    }
 
-    glm::vec3 ab = b - a;
-    glm::vec3 ac = c - a;
-    glm::vec3 n = glm::cross(ab, ac);
+    glm::ivec2 lo = glm::ivec2(std::min({p.pos[0].x, p.pos[1].x, p.pos[2].x}), std::min({p.pos[0].y, p.pos[1].y, p.pos[2].y}));
+    glm::ivec2 hi = glm::ivec2(std::max({p.pos[0].x, p.pos[1].x, p.pos[2].x}), std::max({p.pos[0].y, p.pos[1].y, p.pos[2].y}));
+    if (hi.x - lo.x > MAX_PRIMITIVE_WIDTH || hi.y - lo.y > MAX_PRIMITIVE_HEIGHT) return false;
 
-    return n.z < 0;
+    p.min = glm::ivec2(gpu->minDrawingX(lo.x), gpu->minDrawingY(lo.y));
+    p.max = glm::ivec2(gpu->maxDrawingX(hi.x), gpu->maxDrawingY(hi.y));
+    if (p.min.x >= p.max.x || p.min.y >= p.max.y) return false;
+
+    int area = orient2d(p.pos[0], p.pos[1], p.pos[2]);
+    if (area == 0) return false;
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+        std::swap(p.pos[1], p.pos[2]);
+    }
+    return true;
 }
 
 INLINE int fast_round(float n) {
@@ -39,22 +41,18 @@ INLINE int fast_round(float n) {
     return i + r * 2;
 }
 
-void triangle(GPU* gpu, glm::ivec2 pos[3], glm::vec3 color[3], glm::ivec2 tex[3], glm::ivec2 texPage, glm::ivec2 clut, int bits,
-              int flags) {
-    for (int i = 0; i < 3; i++) {
-        pos[i].x += gpu->drawingOffsetX;
-        pos[i].y += gpu->drawingOffsetY;
-    }
-    // clang-format off
-    glm::ivec2 min = glm::ivec2(
-        gpu->minDrawingX(std::min({ pos[0].x, pos[1].x, pos[2].x })),
-        gpu->minDrawingY(std::min({ pos[0].y, pos[1].y, pos[2].y }))
-    );
-    glm::ivec2 max = glm::ivec2(
-        gpu->maxDrawingX(std::max({ pos[0].x, pos[1].x, pos[2].x })),
-        gpu->maxDrawingY(std::max({ pos[0].y, pos[1].y, pos[2].y }))
-    );
-    // clang-format on
+void rasterizeTriangle(GPU* gpu, const Primitive& prim, glm::ivec2 clipMin, glm::ivec2 clipMax, PixelStats* stats) {
+    const glm::ivec2* pos = prim.pos;
+    const glm::ivec3* color = prim.color;
+    const glm::ivec2* tex = prim.tex;
+    const glm::ivec2 texPage = prim.texPage;
+    const glm::ivec2 clut = prim.clut;
+    const int bits = prim.bits;
+    const int flags = prim.flags;
+    const GP0_E2 textureWindow = prim.textureWindow;
+
+    glm::ivec2 min = glm::ivec2(std::max(prim.min.x, clipMin.x), std::max(prim.min.y, clipMin.y));
+    glm::ivec2 max = glm::ivec2(std::min(prim.max.x, clipMax.x), std::min(prim.max.y, clipMax.y));
 
     // https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
     int A01 = pos[0].y - pos[1].y;
@@ -72,34 +70,43 @@ void triangle(GPU* gpu, glm::ivec2 pos[3], glm::vec3 color[3], glm::ivec2 tex[3]
     int w2_row = orient2d(pos[0], pos[1], minp);
 
     int area = orient2d(pos[0], pos[1], pos[2]);
-    if (area == 0) return;
 
     glm::ivec2 p;
 
-    for (p.y = min.y; p.y < max.y; p.y++) {
+    for (p.y = min.y; p.y < max.y; p.y++, w0_row += B12, w1_row += B20, w2_row += B01) {
+        if ((p.y & 1) == prim.skippedField) continue;
+        if (stats) stats->tested += std::max(max.x - min.x, 0);
+
+        // Pixels of a row are distinct, blended ones are collected into pairs regardless of their position
+        uint16_t* pending = nullptr;
+        PSXColor pendingColor;
+
         glm::ivec3 is = glm::ivec3(w0_row, w1_row, w2_row);
         for (p.x = min.x; p.x < max.x; p.x++) {
             if ((is.x | is.y | is.z) >= 0) {
-                glm::vec3 s = glm::vec3(is) / (float)area;
-
-                PSXColor c;
-                if (bits == 0) {
+                // Interpolated (gouraud) or flat color, 0 - 255
+                glm::ivec3 shade = color[0];
+                if (flags & Vertex::GouroudShading) {
                     // clang-format off
-                    glm::vec3 calculatedColor = glm::vec3(
-                        s.x * color[0].r + s.y * color[1].r + s.z * color[2].r,
-                        s.x * color[0].g + s.y * color[1].g + s.z * color[2].g,
-                        s.x * color[0].b + s.y * color[1].b + s.z * color[2].b
+                    shade = glm::ivec3(
+                        (is.x * color[0].r + is.y * color[1].r + is.z * color[2].r) / area,
+                        (is.x * color[0].g + is.y * color[1].g + is.z * color[2].g) / area,
+                        (is.x * color[0].b + is.y * color[1].b + is.z * color[2].b) / area
                     );
                     // clang-format on
+                }
 
+                PSXColor c;
+                if (bits == 0) {
                     // TODO: THPS2 fading screen doesn't look as it should
                     if (flags & Vertex::Dithering && !(flags & Vertex::RawTexture)) {
-                        calculatedColor += ditherTable[p.y % 4][p.x % 4] / 255.f;
-                        calculatedColor = glm::clamp(calculatedColor, 0.f, 1.f);
+                        c._ = dither15bit(shade.r, shade.g, shade.b, p.y & 3, p.x & 3);
+                    } else {
+                        c._ = to15bit(shade.r, shade.g, shade.b);
                     }
-                    c._ = to15bit((uint8_t)(255 * calculatedColor.r), (uint8_t)(255 * calculatedColor.g),
-                                  (uint8_t)(255 * calculatedColor.b));
                 } else {
+                    glm::vec3 s = glm::vec3(is) / (float)area;
+
                     // clang-format off
                     glm::ivec2 calculatedTexel = glm::ivec2(
                         fast_round(s.x * tex[0].x + s.y * tex[1].x + s.z * tex[2].x),
@@ -108,8 +115,8 @@ void triangle(GPU* gpu, glm::ivec2 pos[3], glm::vec3 color[3], glm::ivec2 tex[3]
 
                     // Texture masking
                     // texel = (texel AND(NOT(Mask * 8))) OR((Offset AND Mask) * 8)
-                    calculatedTexel.x = (calculatedTexel.x & ~(gpu->gp0_e2.textureWindowMaskX * 8)) | ((gpu->gp0_e2.textureWindowOffsetX &gpu->gp0_e2.textureWindowMaskX) * 8);
-                    calculatedTexel.y = (calculatedTexel.y & ~(gpu->gp0_e2.textureWindowMaskY * 8)) | ((gpu->gp0_e2.textureWindowOffsetY &gpu->gp0_e2.textureWindowMaskY) * 8);
+                    calculatedTexel.x = (calculatedTexel.x & ~(textureWindow.textureWindowMaskX * 8)) | ((textureWindow.textureWindowOffsetX &textureWindow.textureWindowMaskX) * 8);
+                    calculatedTexel.y = (calculatedTexel.y & ~(textureWindow.textureWindowMaskY * 8)) | ((textureWindow.textureWindowOffsetY &textureWindow.textureWindowMaskY) * 8);
 
                     // clang-format on
                     if (bits == 4) {
@@ -117,7 +124,7 @@ void triangle(GPU* gpu, glm::ivec2 pos[3], glm::vec3 color[3], glm::ivec2 tex[3]
                     } else if (bits == 8) {
                         c = tex8bit(gpu, calculatedTexel, texPage, clut);
                     } else if (bits == 16) {
-                        c = VRAM[texPage.y + calculatedTexel.y][texPage.x + calculatedTexel.x];
+                        c = texel(gpu, texPage.x + calculatedTexel.x, texPage.y + calculatedTexel.y);
                         // TODO: In PSOne BIOS colors are swapped (r == b, g == g, b == r, k == k)
                     }
                 }
@@ -126,43 +133,22 @@ void triangle(GPU* gpu, glm::ivec2 pos[3], glm::vec3 color[3], glm::ivec2 tex[3]
 
                 // If texture blending is enabled
                 if (bits != 0 && !(flags & Vertex::RawTexture)) {
-                    glm::vec3 brightness;
-
-                    if (flags & Vertex::GouroudShading) {
-                        brightness = glm::vec3(s.x * color[0].r + s.y * color[1].r + s.z * color[2].r,
-                                               s.x * color[0].g + s.y * color[1].g + s.z * color[2].g,
-                                               s.x * color[0].b + s.y * color[1].b + s.z * color[2].b);
-                    } else {  // Flat shading
-                        brightness = glm::vec3(color[0]);
-                    }
-
-                    c = c * (brightness * 2.f);
+                    c._ = modulate(c._, shade.r, shade.g, shade.b);
                 }
 
                 // TODO: Mask support
-
-                if ((flags & Vertex::SemiTransparency) && c.k) {
-                    using Transparency = GP0_E1::SemiTransparency;
-
-                    PSXColor bg = VRAM[p.y][p.x];
-                    Transparency transparency = (Transparency)((flags & 0xA0) >> 6);
-                    switch (transparency) {
-                        case Transparency::Bby2plusFby2:
-                            c = bg / 2.f + c / 2.f;
-                            break;
-                        case Transparency::BplusF:
-                            c = bg + c;
-                            break;
-                        case Transparency::BminusF:
-                            c = bg - c;
-                            break;
-                        case Transparency::BplusFby4:
-                            c = bg + c / 4.f;
-                            break;
-                    }
+                bool blend = (flags & Vertex::SemiTransparency) && c.k;
+                uint16_t& pixel = gpu->pixel(p.x, p.y);
+                if (!blend) {
+                    pixel = c._;
+                } else if (pending != nullptr) {
+                    putPixelPair(*pending, pendingColor, pixel, c, prim.transparency);
+                    pending = nullptr;
+                } else {
+                    pending = &pixel;
+                    pendingColor = c;
                 }
-
-                VRAM[p.y][p.x] = c._;
+                if (stats) stats->write(p.x, p.y, bits != 0, blend);
             }
 
         skip_pixel:
@@ -170,37 +156,32 @@ void triangle(GPU* gpu, glm::ivec2 pos[3], glm::vec3 color[3], glm::ivec2 tex[3]
             is.y += A20;
             is.z += A01;
         }
-        w0_row += B12;
-        w1_row += B20;
-        w2_row += B01;
+        if (pending != nullptr) putPixel(*pending, pendingColor, true, prim.transparency);
     }
 }
 
-// TODO: Render in batches
 void drawTriangle(GPU* gpu, Vertex v[3]) {
-    glm::ivec2 pos[3];
-    glm::vec3 color[3];
-    glm::ivec2 texcoord[3];
-    glm::ivec2 texpage;
-    glm::ivec2 clut;
-    int bits;
-    int flags;
-    for (int j = 0; j < 3; j++) {
-        pos[j] = glm::ivec2(v[j].position[0], v[j].position[1]);
-        color[j] = glm::vec3(v[j].color[0] / 255.f, v[j].color[1] / 255.f, v[j].color[2] / 255.f);
-        texcoord[j] = glm::ivec2(v[j].texcoord[0], v[j].texcoord[1]);
-    }
+    Primitive p;
+    if (!setupTriangle(gpu, v, p)) return;
 
-    // TODO: Remove this hack
-    if (isCw(pos)) {
-        std::swap(pos[1], pos[2]);
-        std::swap(color[1], color[2]);
-        std::swap(texcoord[1], texcoord[2]);
+    if (gpu->hardwareRenderer) {
+        gpu->hardwareRenderer->drawTriangle(gpu, v);
+        return;
     }
-    texpage = glm::ivec2(v[0].texpage[0], v[0].texpage[1]);
-    clut = glm::ivec2(v[0].clut[0], v[0].clut[1]);
-    bits = v[0].bitcount;
-    flags = v[0].flags;
 
-    triangle(gpu, pos, color, texcoord, texpage, clut, bits, flags);
-}
\ No newline at end of file
+    p.type = Primitive::Type::Triangle;
+    for (int j = 0; j < 3; j++) {
+        p.color[j] = glm::ivec3(v[j].color[0], v[j].color[1], v[j].color[2]);
+        p.tex[j] = glm::ivec2(v[j].texcoord[0], v[j].texcoord[1]);
+    }
+    p.texPage = glm::ivec2(v[0].texpage[0], v[0].texpage[1]);
+    p.clut = glm::ivec2(v[0].clut[0], v[0].clut[1]);
+    p.bits = v[0].bitcount;
+    p.flags = v[0].flags;
+    p.transparency = v[0].transparency();
+    p.textureWindow = gpu->gp0_e2;
+    p.flatColor = 0;
+    p.skippedField = gpu->skippedField();
+
+    gpu->rasterizer->submit(p);
+}
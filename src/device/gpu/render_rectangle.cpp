@@ -1,6 +1,24 @@
+#include <algorithm>
 #include "render.h"
 
-#undef VRAM
-#define VRAM ((uint16_t(*)[VRAM_WIDTH])gpu->vram.data())
+void drawRectangle(GPU* gpu, const int16_t x[4], const int16_t y[4], const RGB color[4], const TextureInfo tex, bool textured, int flags) {}
 
-void drawRectangle(GPU* gpu, const int16_t x[4], const int16_t y[4], const RGB color[4], const TextureInfo tex, bool textured, int flags) {}
\ No newline at end of file
+void rasterizeFill(GPU* gpu, const Primitive& p, glm::ivec2 clipMin, glm::ivec2 clipMax, PixelStats* stats) {
+    glm::ivec2 min = glm::ivec2(std::max(p.min.x, clipMin.x), std::max(p.min.y, clipMin.y));
+    glm::ivec2 max = glm::ivec2(std::min(p.max.x, clipMax.x), std::min(p.max.y, clipMax.y));
+    if (min.x >= max.x) return;
+
+    for (int y = min.y; y < max.y; y++) {
+        if ((y & 1) == p.skippedField) continue;
+        for (int x = min.x; x < max.x;) {
+            int n = std::min(vramRun(x), max.x - x);
+            std::fill_n(&gpu->pixel(x, y), n, p.flatColor);
+            x += n;
+        }
+
+        if (stats) {
+            stats->tested += max.x - min.x;
+            for (int x = min.x; x < max.x; x++) stats->write(x, y, false, false);
+        }
+    }
+}
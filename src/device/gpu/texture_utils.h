@@ -1,18 +1,17 @@
 #pragma once
 #include "gpu.h"
 
-#define gpuVRAM ((uint16_t(*)[VRAM_WIDTH])gpu->vram.data())
+// Texture and CLUT addressing wraps around VRAM edges
+inline uint16_t texel(GPU* gpu, int x, int y) { return gpu->pixel(x & (VRAM_WIDTH - 1), y & (VRAM_HEIGHT - 1)); }
 
 inline uint16_t tex4bit(GPU* gpu, glm::ivec2 tex, glm::ivec2 texPage, glm::ivec2 clut) {
-    uint16_t index = gpuVRAM[texPage.y + tex.y][texPage.x + tex.x / 4];
+    uint16_t index = texel(gpu, texPage.x + tex.x / 4, texPage.y + tex.y);
     uint16_t entry = (index >> ((tex.x & 3) * 4)) & 0xf;
-    return gpuVRAM[clut.y][clut.x + entry];
+    return texel(gpu, clut.x + entry, clut.y);
 }
 
 inline uint16_t tex8bit(GPU* gpu, glm::ivec2 tex, glm::ivec2 texPage, glm::ivec2 clut) {
-    uint16_t index = gpuVRAM[texPage.y + tex.y][texPage.x + tex.x / 2];
+    uint16_t index = texel(gpu, texPage.x + tex.x / 2, texPage.y + tex.y);
     uint16_t entry = (index >> ((tex.x & 1) * 8)) & 0xff;
-    return gpuVRAM[clut.y][clut.x + entry];
-}
-
-#undef gpuVRAM
\ No newline at end of file
+    return texel(gpu, clut.x + entry, clut.y);
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "vram_dirty.h"
+#include <algorithm>
+#include <iterator>
+
+void VramDirtyMap::mark(int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0) return;
+    x &= WIDTH - 1;
+    y &= HEIGHT - 1;
+    if (w > WIDTH) w = WIDTH;
+    if (h > HEIGHT) h = HEIGHT;
+
+    // Split areas crossing VRAM edge
+    if (x + w > WIDTH) {
+        mark(0, y, x + w - WIDTH, h);
+        w = WIDTH - x;
+    }
+    if (y + h > HEIGHT) {
+        mark(x, 0, w, y + h - HEIGHT);
+        h = HEIGHT - y;
+    }
+
+    int blockMinX = x / BLOCK_WIDTH;
+    int blockMaxX = (x + w - 1) / BLOCK_WIDTH;
+    uint32_t mask = ((1u << (blockMaxX - blockMinX + 1)) - 1) << blockMinX;
+
+    for (int by = y / BLOCK_HEIGHT; by <= (y + h - 1) / BLOCK_HEIGHT; by++) {
+        rows[by] |= mask;
+    }
+}
+
+void VramDirtyMap::markAll() { std::fill(std::begin(rows), std::end(rows), (1u << BLOCKS_X) - 1); }
+
+void VramDirtyMap::merge(const VramDirtyMap& other) {
+    for (int by = 0; by < BLOCKS_Y; by++) rows[by] |= other.rows[by];
+}
+
+void VramDirtyMap::clear() { std::fill(std::begin(rows), std::end(rows), 0); }
+
+bool VramDirtyMap::empty() const {
+    return std::all_of(std::begin(rows), std::end(rows), [](uint32_t row) { return row == 0; });
+}
+
+bool VramDirtyMap::intersects(int x, int y, int w, int h) const {
+    VramDirtyMap area;
+    area.mark(x, y, w, h);
+    return intersects(area);
+}
+
+bool VramDirtyMap::intersects(const VramDirtyMap& other) const {
+    for (int by = 0; by < BLOCKS_Y; by++) {
+        if (rows[by] & other.rows[by]) return true;
+    }
+    return false;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * Set of modified VRAM areas with 64x16 block granularity.
+ * Each block row is stored as a bitmask, so marking and merging are cheap
+ * enough to be done for every primitive and transfer.
+ */
+class VramDirtyMap {
+   public:
+    static const int WIDTH = 1024;
+    static const int HEIGHT = 512;
+    static const int BLOCK_WIDTH = 64;
+    static const int BLOCK_HEIGHT = 16;
+    static const int BLOCKS_X = WIDTH / BLOCK_WIDTH;
+    static const int BLOCKS_Y = HEIGHT / BLOCK_HEIGHT;
+
+    // Coordinates wrap around VRAM edges
+    void mark(int x, int y, int w, int h);
+    void markAll();
+    void merge(const VramDirtyMap& other);
+    void clear();
+
+    bool empty() const;
+    bool intersects(int x, int y, int w, int h) const;
+    bool intersects(const VramDirtyMap& other) const;
+    bool isDirty(int blockX, int blockY) const { return (rows[blockY] >> blockX) & 1; }
+
+    // Calls fn(x, y, w, h) for each dirty area (in pixels).
+    // Adjacent blocks are joined horizontally, block rows with identical masks vertically.
+    template <typename F>
+    void forEachArea(F fn) const {
+        int by = 0;
+        while (by < BLOCKS_Y) {
+            uint32_t mask = rows[by];
+            int height = 1;
+            while (by + height < BLOCKS_Y && rows[by + height] == mask) height++;
+
+            int bx = 0;
+            while (mask != 0) {
+                while (!(mask & 1)) {
+                    mask >>= 1;
+                    bx++;
+                }
+                int width = 0;
+                while (mask & 1) {
+                    mask >>= 1;
+                    width++;
+                }
+                fn(bx * BLOCK_WIDTH, by * BLOCK_HEIGHT, width * BLOCK_WIDTH, height * BLOCK_HEIGHT);
+                bx += width;
+            }
+            by += height;
+        }
+    }
+
+   private:
+    uint32_t rows[BLOCKS_Y] = {};
+};
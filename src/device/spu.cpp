@@ -1,10 +1,294 @@
 #include "spu.h"
 #include "mips.h"
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+const int filterPos[5] = {0, 60, 115, 98, 122};
+const int filterNeg[5] = {0, 0, -52, -55, -60};
+
+// 4 tap interpolation weights for 256 positions between the two middle samples.
+// Hardware uses a ROM table of gaussian shaped weights, this one is computed from gaussian curve and sums to 0x7fff.
+struct GaussTable {
+    int16_t weight[256][4];
+
+    GaussTable() {
+        const double sigma = 0.55;
+        for (int i = 0; i < 256; i++) {
+            double f = i / 256.0;
+            double distance[4] = {1 + f, f, 1 - f, 2 - f};
+            double g[4], sum = 0;
+            for (int k = 0; k < 4; k++) {
+                g[k] = std::exp(-distance[k] * distance[k] / (2 * sigma * sigma));
+                sum += g[k];
+            }
+
+            int total = 0;
+            for (int k = 0; k < 4; k++) {
+                weight[i][k] = (int16_t)(g[k] / sum * 0x7fff);
+                total += weight[i][k];
+            }
+            weight[i][i < 128 ? 1 : 2] += 0x7fff - total;
+        }
+    }
+};
+const GaussTable gauss;
+
+// Fixed mode holds volume / 2, sweep mode is not emulated and keeps last fixed volume
+inline int16_t fixedVolume(uint16_t reg, int16_t current) { return (reg & 0x8000) ? current : (int16_t)(reg << 1); }
+
+// (a * b) >> 15 with lowest bit cleared, same as SSE2 mulhi followed by shift
+inline int16_t multiply(int16_t a, int16_t b) { return (int16_t)(((a * b) >> 16) << 1); }
+
+inline int16_t clamp16(int32_t v) { return (int16_t)std::min(std::max(v, -0x8000), 0x7fff); }
+}  // namespace
 
-SPU::SPU() { memset(ram, 0, RAM_SIZE); }
+SPU::SPU() : blockCache(RAM_SIZE / BLOCK_SIZE), audio(std::make_shared<AudioStream>()) {
+    memset(ram, 0, RAM_SIZE);
+    memset(&lanes, 0, sizeof(lanes));
+    memset(&unalignedBlock, 0, sizeof(unalignedBlock));
+}
+
+void SPU::step(int cycles) {
+    sampleCycles += cycles;
+    while (sampleCycles >= BATCH_SAMPLES * SAMPLE_CYCLES) {
+        sampleCycles -= BATCH_SAMPLES * SAMPLE_CYCLES;
+        mixBatch();
+    }
+}
 
-void SPU::step() {}
+void SPU::keyOn(int voice) {
+    lanes.address[voice] = voices[voice].startAddress._reg * 8 % RAM_SIZE;
+    lanes.sample[voice] = 0;
+    lanes.counter[voice] = 0;
+    lanes.prev[0][voice] = lanes.prev[1][voice] = 0;
+    for (int k = 0; k < 4; k++) {
+        lanes.history[k][voice] = 0;
+        lanes.weight[k][voice] = gauss.weight[0][k];
+    }
+    lanes.envelope[voice] = 0;
+    lanes.envelopeWait[voice] = 0;
+    lanes.phase[voice] = Phase::Attack;
+
+    voiceStatus._reg &= ~(1u << voice);
+    activeVoices |= 1u << voice;
+}
+
+void SPU::keyOff(int voice) {
+    if (lanes.phase[voice] == Phase::Off) return;
+    lanes.phase[voice] = Phase::Release;
+    lanes.envelopeWait[voice] = 0;
+}
+
+const SPU::DecodedBlock& SPU::decodeBlock(uint32_t address) {
+    // Games keep samples 16 byte aligned, anything else is decoded every time
+    bool aligned = address % BLOCK_SIZE == 0;
+    DecodedBlock& block = aligned ? blockCache[address / BLOCK_SIZE] : unalignedBlock;
+    if (aligned && block.valid) return block;
+
+    auto byte = [&](int n) { return ram[(address + n) % RAM_SIZE]; };
+    int shift = byte(0) & 0x0f;
+    if (shift > 12) shift = 9;
+    block.filter = (uint8_t)std::min((byte(0) >> 4) & 7, 4);
+    block.flags = byte(1);
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        int nibble = (byte(2 + i / 2) >> ((i & 1) * 4)) & 0x0f;
+        block.samples[i] = (int16_t)((int16_t)(nibble << 12) >> shift);
+    }
+    block.valid = aligned;
+    return block;
+}
+
+int16_t SPU::nextSample(int voice) {
+    uint32_t& address = lanes.address[voice];
+    int& i = lanes.sample[voice];
+    const DecodedBlock& block = decodeBlock(address);
+    if (i == 0 && (block.flags & LoopStart)) voices[voice].repeatAddress._reg = address / 8;
+
+    int32_t old = lanes.prev[0][voice];
+    int32_t older = lanes.prev[1][voice];
+    int16_t sample = clamp16(block.samples[i] + ((old * filterPos[block.filter] + older * filterNeg[block.filter] + 32) >> 6));
+    lanes.prev[1][voice] = old;
+    lanes.prev[0][voice] = sample;
+
+    if (++i == BLOCK_SAMPLES) {
+        i = 0;
+        if (block.flags & LoopEnd) {
+            voiceStatus._reg |= 1u << voice;
+            address = voices[voice].repeatAddress._reg * 8 % RAM_SIZE;
+            if (!(block.flags & LoopRepeat)) {
+                lanes.phase[voice] = Phase::Off;
+                lanes.envelope[voice] = 0;
+                activeVoices &= ~(1u << voice);
+            }
+        } else {
+            address = (address + BLOCK_SIZE) % RAM_SIZE;
+        }
+    }
+    return sample;
+}
+
+void SPU::stepEnvelope(int voice) {
+    if (lanes.envelopeWait[voice] > 0) {
+        lanes.envelopeWait[voice]--;
+        return;
+    }
+
+    const uint32_t adsr = voices[voice].ADSR._reg;
+    const int sustainLevel = std::min(((int)(adsr & 0x0f) + 1) * 0x800, 0x7fff);
+    bool exponential, decrease;
+    int shift, step;
+
+    switch (lanes.phase[voice]) {
+        case Phase::Attack:
+            exponential = adsr & (1 << 15);
+            decrease = false;
+            shift = (adsr >> 10) & 0x1f;
+            step = 7 - (int)((adsr >> 8) & 3);
+            break;
+        case Phase::Decay:
+            exponential = true;
+            decrease = true;
+            shift = (adsr >> 4) & 0x0f;
+            step = -8;
+            break;
+        case Phase::Sustain:
+            exponential = adsr & (1u << 31);
+            decrease = adsr & (1 << 30);
+            shift = (adsr >> 24) & 0x1f;
+            step = decrease ? -8 + (int)((adsr >> 22) & 3) : 7 - (int)((adsr >> 22) & 3);
+            break;
+        case Phase::Release:
+            exponential = adsr & (1 << 21);
+            decrease = true;
+            shift = (adsr >> 16) & 0x1f;
+            step = -8;
+            break;
+        default: return;
+    }
+
+    int level = lanes.envelope[voice];
+    int cycles = 1 << std::max(0, shift - 11);
+    int delta = step * (1 << std::max(0, 11 - shift));
+    if (exponential && !decrease && level > 0x6000) cycles *= 4;
+    if (exponential && decrease) delta = (delta * level) >> 15;
+
+    level = std::min(std::max(level + delta, 0), 0x7fff);
+    lanes.envelope[voice] = (int16_t)level;
+    lanes.envelopeWait[voice] = cycles - 1;
+
+    if (lanes.phase[voice] == Phase::Attack && level == 0x7fff) {
+        lanes.phase[voice] = Phase::Decay;
+    } else if (lanes.phase[voice] == Phase::Decay && level <= sustainLevel) {
+        lanes.phase[voice] = Phase::Sustain;
+    } else if (lanes.phase[voice] == Phase::Release && level == 0) {
+        lanes.phase[voice] = Phase::Off;
+        activeVoices &= ~(1u << voice);
+    }
+}
+
+// Moves voice to its next output sample: envelope, pitch counter, newly needed ADPCM samples and interpolation weights
+void SPU::advanceVoice(int voice) {
+    stepEnvelope(voice);
+
+    uint32_t& counter = lanes.counter[voice];
+    counter += std::min<uint32_t>(voices[voice].sampleRate._reg, 0x4000);
+    while (counter >= 0x1000 && (activeVoices & (1u << voice))) {
+        counter -= 0x1000;
+        for (int k = 0; k < 3; k++) lanes.history[k][voice] = lanes.history[k + 1][voice];
+        lanes.history[3][voice] = nextSample(voice);
+    }
+
+    const int16_t* weight = gauss.weight[(counter >> 4) & 0xff];
+    for (int k = 0; k < 4; k++) lanes.weight[k][voice] = weight[k];
+}
+
+// Interpolation, envelope and volume of all voices summed, voices that are off have zero envelope
+void SPU::mixVoices(int32_t& left, int32_t& right) const {
+    int v = 0;
+#ifdef __SSE2__
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i accLeft = _mm_setzero_si128();
+    __m128i accRight = _mm_setzero_si128();
+
+    for (; v < VOICE_COUNT; v += 8) {
+        __m128i h[4], w[4];
+        for (int k = 0; k < 4; k++) {
+            h[k] = _mm_load_si128((const __m128i*)&lanes.history[k][v]);
+            w[k] = _mm_load_si128((const __m128i*)&lanes.weight[k][v]);
+        }
+
+        // Samples and weights of tap pairs interleaved, madd sums both products in 32 bits
+        __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(h[0], h[1]), _mm_unpacklo_epi16(w[0], w[1])),
+                                   _mm_madd_epi16(_mm_unpacklo_epi16(h[2], h[3]), _mm_unpacklo_epi16(w[2], w[3])));
+        __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(h[0], h[1]), _mm_unpackhi_epi16(w[0], w[1])),
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(h[2], h[3]), _mm_unpackhi_epi16(w[2], w[3])));
+        __m128i sample = _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+
+        sample = _mm_slli_epi16(_mm_mulhi_epi16(sample, _mm_load_si128((const __m128i*)&lanes.envelope[v])), 1);
+        __m128i l = _mm_slli_epi16(_mm_mulhi_epi16(sample, _mm_load_si128((const __m128i*)&lanes.volumeLeft[v])), 1);
+        __m128i r = _mm_slli_epi16(_mm_mulhi_epi16(sample, _mm_load_si128((const __m128i*)&lanes.volumeRight[v])), 1);
+        accLeft = _mm_add_epi32(accLeft, _mm_madd_epi16(l, ones));
+        accRight = _mm_add_epi32(accRight, _mm_madd_epi16(r, ones));
+    }
+
+    alignas(16) int32_t sumLeft[4], sumRight[4];
+    _mm_store_si128((__m128i*)sumLeft, accLeft);
+    _mm_store_si128((__m128i*)sumRight, accRight);
+    left = sumLeft[0] + sumLeft[1] + sumLeft[2] + sumLeft[3];
+    right = sumRight[0] + sumRight[1] + sumRight[2] + sumRight[3];
+#else
+    left = right = 0;
+#endif
+    for (; v < VOICE_COUNT; v++) {
+        int32_t sum = 0;
+        for (int k = 0; k < 4; k++) sum += lanes.history[k][v] * lanes.weight[k][v];
+        int16_t sample = multiply(clamp16(sum >> 15), lanes.envelope[v]);
+        left += multiply(sample, lanes.volumeLeft[v]);
+        right += multiply(sample, lanes.volumeRight[v]);
+    }
+}
+
+void SPU::mixBatch() {
+    int16_t output[BATCH_SAMPLES * 2];
+    int16_t cd[BATCH_SAMPLES * 2] = {};
+    cdAudio.pop(cd, BATCH_SAMPLES * 2);
+
+    for (int v = 0; v < VOICE_COUNT; v++) {
+        lanes.volumeLeft[v] = fixedVolume(voices[v].volume._reg & 0xffff, lanes.volumeLeft[v]);
+        lanes.volumeRight[v] = fixedVolume(voices[v].volume._reg >> 16, lanes.volumeRight[v]);
+    }
+    mainLeft = fixedVolume(mainVolume._reg & 0xffff, mainLeft);
+    mainRight = fixedVolume(mainVolume._reg >> 16, mainRight);
+
+    // Enable and mute bits only apply to voices (muted ones keep running), CD input has its own enable bit
+    const bool enabled = SPUCNT._reg & (1 << 15);
+    const bool unmuted = SPUCNT._reg & (1 << 14);
+    const int16_t cdLeft = (SPUCNT._reg & (1 << 0)) ? (int16_t)(cdVolume._reg & 0xffff) : 0;
+    const int16_t cdRight = (SPUCNT._reg & (1 << 0)) ? (int16_t)(cdVolume._reg >> 16) : 0;
+
+    for (int i = 0; i < BATCH_SAMPLES; i++) {
+        int32_t left = 0, right = 0;
+        if (enabled && activeVoices) {
+            mixVoices(left, right);
+            for (int v = 0; v < VOICE_COUNT; v++) {
+                if (activeVoices & (1u << v)) advanceVoice(v);
+            }
+        }
+        if (!unmuted) left = right = 0;
+
+        // CD audio enters after main volume
+        output[i * 2 + 0] = clamp16(((clamp16(left) * mainLeft) >> 15) + ((cd[i * 2 + 0] * cdLeft) >> 15));
+        output[i * 2 + 1] = clamp16(((clamp16(right) * mainRight) >> 15) + ((cd[i * 2 + 1] * cdRight) >> 15));
+    }
+
+    for (int v = 0; v < VOICE_COUNT; v++) voices[v].ADSRVolume._reg = lanes.envelope[v];
+    audio->push(output, BATCH_SAMPLES * 2);
+}
 
 uint8_t SPU::readVoice(uint32_t address) const {
     int voice = address / 0x10;
@@ -95,6 +379,10 @@ uint8_t SPU::read(uint32_t address) {
         return readVoice(address - 0x1f801c00);
     }
 
+    if (address >= 0x1f801d9c && address <= 0x1f801d9f) {  // Voices ENDX
+        return voiceStatus.read(address - 0x1f801d9c);
+    }
+
     if (address >= 0x1f801da6 && address <= 0x1f801da7) {  // Data address
         return dataAddress.read(address - 0x1f801da6);
     }
@@ -114,6 +402,10 @@ uint8_t SPU::read(uint32_t address) {
         return SPUSTAT.read(address - 0x1f801dae);
     }
 
+    if (address >= 0x1f801db0 && address <= 0x1f801db3) {  // CD Volume L/R
+        return cdVolume.read(address - 0x1f801db0);
+    }
+
     // printf("UNHANDLED SPU READ AT 0x%08x\n", address);
 
     return 0;
@@ -138,12 +430,20 @@ void SPU::write(uint32_t address, uint8_t data) {
     }
 
     if (address >= 0x1f801d88 && address <= 0x1f801d8b) {  // Voices Key On
-        voiceKeyOn.write(address - 0x1f801d88, data);
+        int n = address - 0x1f801d88;
+        voiceKeyOn.write(n, data);
+        for (int i = 0; i < 8; i++) {
+            if ((data & (1 << i)) && n * 8 + i < VOICE_COUNT) keyOn(n * 8 + i);
+        }
         return;
     }
 
     if (address >= 0x1f801d8c && address <= 0x1f801d8f) {  // Voices Key Off
-        voiceKeyOff.write(address - 0x1f801d8c, data);
+        int n = address - 0x1f801d8c;
+        voiceKeyOff.write(n, data);
+        for (int i = 0; i < 8; i++) {
+            if ((data & (1 << i)) && n * 8 + i < VOICE_COUNT) keyOff(n * 8 + i);
+        }
         return;
     }
 
@@ -168,6 +468,7 @@ void SPU::write(uint32_t address, uint8_t data) {
         if (currentDataAddress >= RAM_SIZE) {
             currentDataAddress %= RAM_SIZE;
         }
+        invalidate(currentDataAddress);
         ram[currentDataAddress++] = data;
         return;
     }
@@ -184,10 +485,33 @@ void SPU::write(uint32_t address, uint8_t data) {
 
     if (address >= 0x1f801dae && address <= 0x1f801daf) {  // SPUSTAT
         SPUSTAT.write(address - 0x1f801dae, data);
+        return;
+    }
+
+    if (address >= 0x1f801db0 && address <= 0x1f801db3) {  // CD Volume L/R
+        cdVolume.write(address - 0x1f801db0, data);
+        return;
     }
     // printf("UNHANDLED SPU WRITE AT 0x%08x: 0x%02x\n", address, data);
 }
 
+void SPU::readBlock(uint32_t* data, size_t count) {
+    uint8_t* dst = (uint8_t*)data;
+    for (size_t i = 0; i < count * 4; i++) {
+        currentDataAddress %= RAM_SIZE;
+        dst[i] = ram[currentDataAddress++];
+    }
+}
+
+void SPU::writeBlock(const uint32_t* data, size_t count) {
+    const uint8_t* src = (const uint8_t*)data;
+    for (size_t i = 0; i < count * 4; i++) {
+        currentDataAddress %= RAM_SIZE;
+        invalidate(currentDataAddress);
+        ram[currentDataAddress++] = src[i];
+    }
+}
+
 void SPU::dumpRam() {
     std::vector<uint8_t> ram;
     ram.assign(this->ram, this->ram + RAM_SIZE - 1);
@@ -1,6 +1,11 @@
 #pragma once
 #include "device.h"
+#include <cstddef>
 #include <deque>
+#include <memory>
+#include <vector>
+#include "sound/audio_stream.h"
+#include "utils/ring_buffer.h"
 
 class SPU {
     struct Voice {
@@ -24,16 +29,55 @@ class SPU {
         DataTransferControl() : _reg(0) {}
     };
 
+    // ADPCM block with shift applied, prediction filter depends on previous samples and runs per voice
+    struct DecodedBlock {
+        int16_t samples[28];
+        uint8_t filter;
+        uint8_t flags;
+        bool valid;
+    };
+
+    enum BlockFlags : uint8_t { LoopEnd = 1 << 0, LoopRepeat = 1 << 1, LoopStart = 1 << 2 };
+    enum class Phase : uint8_t { Off, Attack, Decay, Sustain, Release };
+
     static const uint32_t BASE_ADDRESS = 0x1f801c00;
     static const int VOICE_COUNT = 24;
     static const int RAM_SIZE = 1024 * 512;
+    static const int BLOCK_SIZE = 16;
+    static const int BLOCK_SAMPLES = 28;
 
     Voice voices[VOICE_COUNT];
 
+    // Playback state as structure of arrays, mixer processes lanes of all voices at once
+    struct VoiceLanes {
+        alignas(16) int16_t history[4][VOICE_COUNT];  // Last decoded samples, [3] is newest
+        alignas(16) int16_t weight[4][VOICE_COUNT];   // Interpolation weights for current pitch counter
+        alignas(16) int16_t envelope[VOICE_COUNT];    // 0 for voices that are off
+        alignas(16) int16_t volumeLeft[VOICE_COUNT];
+        alignas(16) int16_t volumeRight[VOICE_COUNT];
+        uint32_t counter[VOICE_COUNT];  // Pitch counter, 12 bit fraction
+        uint32_t address[VOICE_COUNT];  // Current ADPCM block
+        int sample[VOICE_COUNT];        // Next sample in block
+        int32_t prev[2][VOICE_COUNT];   // Prediction filter history
+        int envelopeWait[VOICE_COUNT];  // Samples until next envelope step
+        Phase phase[VOICE_COUNT];
+    } lanes;
+    uint32_t activeVoices = 0;
+    int16_t mainLeft = 0;
+    int16_t mainRight = 0;
+
+    std::vector<DecodedBlock> blockCache;  // Indexed by address / BLOCK_SIZE, invalidated on RAM writes
+    DecodedBlock unalignedBlock;
+
+    int sampleCycles = 0;
+    utils::RingBuffer<int16_t, 1 << 13> cdAudio;
+
     Reg32 mainVolume;
     Reg32 reverbVolume;
+    Reg32 cdVolume;
     Reg32 voiceKeyOn;
     Reg32 voiceKeyOff;
+    Reg32 voiceStatus;  // ENDX, set when voice reaches block with loop end flag
 
     Reg32 voiceChannelReverbMode;
 
@@ -42,20 +86,41 @@ class SPU {
     uint32_t currentDataAddress;
     DataTransferControl dataTransferControl;
 
-    Reg16 SPUCNT;
+    Reg16 SPUCNT;  // bit 15 - SPU enable, bit 14 - unmute (both voices only), bit 0 - CD audio enable
 
     uint8_t ram[1024 * 512];
 
     uint8_t readVoice(uint32_t address) const;
     void writeVoice(uint32_t address, uint8_t data);
 
+    void keyOn(int voice);
+    void keyOff(int voice);
+    void invalidate(uint32_t address) { blockCache[(address % RAM_SIZE) / BLOCK_SIZE].valid = false; }
+    const DecodedBlock& decodeBlock(uint32_t address);
+    int16_t nextSample(int voice);
+    void stepEnvelope(int voice);
+    void advanceVoice(int voice);
+    void mixVoices(int32_t& left, int32_t& right) const;
+    void mixBatch();
+
    public:
+    static const int SAMPLE_CYCLES = CPU_CLOCK / AudioStream::SAMPLE_RATE;
+    static const int BATCH_SAMPLES = 32;  // Samples mixed at once, about 0.7 ms
+
     Reg16 SPUSTAT;
+    std::shared_ptr<AudioStream> audio;  // Mixed voices and CD audio, 44.1 kHz stereo
 
     SPU();
-    void step();
+    void step(int cycles);
     uint8_t read(uint32_t address);
     void write(uint32_t address, uint8_t data);
 
+    // DMA, Data FIFO
+    void readBlock(uint32_t* data, size_t count);
+    void writeBlock(const uint32_t* data, size_t count);
+
+    // CD audio input, interleaved 44.1 kHz stereo
+    void pushCdAudio(const int16_t* samples, size_t count) { cdAudio.push(samples, count); }
+
     void dumpRam();
 };
\ No newline at end of file
@@ -31,12 +31,12 @@ CPU::CPU() {
     serial = std::make_unique<Dummy>("Serial", 0x1f801050, false);
     interrupt = std::make_unique<Interrupt>(this);
     gpu = std::make_unique<GPU>();
+    spu = std::make_unique<SPU>();
     dma = std::make_unique<dma::DMA>(this);
     timer0 = std::make_unique<Timer<0>>(this);
     timer1 = std::make_unique<Timer<1>>(this);
     timer2 = std::make_unique<Timer<2>>(this);
     cdrom = std::make_unique<cdrom::CDROM>(this);
-    spu = std::make_unique<SPU>();
     mdec = std::make_unique<MDEC>();
     expansion2 = std::make_unique<Dummy>("Expansion2", 0x1f802000, false);
 }
@@ -390,7 +390,8 @@ void CPU::singleStep() {
     state = State::pause;
 
     dma->step();
-    cdrom->step();
+    cdrom->step(3);
+    spu->step(3);
     timer0->step(3);
     timer1->step(3);
     timer2->step(3);
@@ -399,6 +400,7 @@ void CPU::singleStep() {
     if (gpu->emulateGpuCycles(3)) {
         interrupt->trigger(interrupt::VBLANK);
     }
+    gpu->flush();
 }
 
 void CPU::emulateFrame() {
@@ -406,18 +408,21 @@ void CPU::emulateFrame() {
     ioLogList.clear();
 #endif
     gte.log.clear();
-    gpu->gpuLogList.clear();
 
-    gpu->prevVram = gpu->vram;
+    // Syncs GPU thread, which might still be executing (and logging) commands of skipped frame
+    gpu->snapshotVram();
+    gpu->gpuLogList.clear();
     int systemCycles = 300;
     for (;;) {
         if (!executeInstructions(systemCycles / 3)) {
             // printf("CPU Halted\n");
+            gpu->flush();
             return;
         }
 
         dma->step();
-        cdrom->step();
+        cdrom->step(systemCycles);
+        spu->step(systemCycles);
         timer0->step(systemCycles);
         timer1->step(systemCycles);
         timer2->step(systemCycles);
@@ -2,14 +2,59 @@
 #include <string>
 #include <memory>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <json.hpp>
 #include "utils/file.h"
 #include "mips.h"
+#include "recorder.h"
+
+// One JSON object per line for each presented frame
+void writeFillStats(FILE *f, int frame, const FillStats &stats) {
+    const int cellSize = 32;
+    std::vector<float> heatmap = stats.heatmap(cellSize);
+    for (float &cell : heatmap) cell = std::round(cell * 100.f) / 100.f;
+
+    nlohmann::json j;
+    j["frame"] = frame;
+    j["primitives"] = {{"polygons", stats.polygons}, {"rectangles", stats.rectangles}, {"lines", stats.lines}, {"fills", stats.fills}};
+    j["pixels"] = {{"tested", stats.pixelsTested},
+                   {"written", stats.pixelsWritten},
+                   {"textured", stats.pixelsTextured},
+                   {"blended", stats.pixelsBlended}};
+    j["overdraw"] = {{"cellSize", cellSize}, {"width", VRAM_WIDTH / cellSize}, {"height", VRAM_HEIGHT / cellSize}, {"cells", heatmap}};
+    fprintf(f, "%s\n", j.dump().c_str());
+}
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        printf("usage: Avocado psx.exe\n");
+        printf("usage: Avocado psx.exe [--fill-stats stats.jsonl] [--video out.y4m|out.png] [--audio out.wav]\n");
         return 1;
     }
+
+    std::string fillStatsPath, videoPath, audioPath;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--fill-stats") == 0) {
+            fillStatsPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--video") == 0) {
+            videoPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--audio") == 0) {
+            audioPath = argv[i + 1];
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    FILE *fillStatsFile = nullptr;
+    if (!fillStatsPath.empty()) {
+        fillStatsFile = fopen(fillStatsPath.c_str(), "w");
+        if (!fillStatsFile) {
+            printf("Cannot open %s\n", fillStatsPath.c_str());
+            return 1;
+        }
+    }
+
     std::unique_ptr<mips::CPU> cpu = std::make_unique<mips::CPU>();
 
     if (!cpu->loadBios("SCPH1001.BIN")) {
@@ -38,10 +83,25 @@ int main(int argc, char **argv) {
     cpu->state = mips::CPU::State::run;
     cpu->debugOutput = false;
     cpu->PC = cpu->readMemory32(0x1f000000);
+    cpu->gpu->fillStatsEnabled = fillStatsFile != nullptr;
+
+    std::unique_ptr<Recorder> recorder;
+    if (!videoPath.empty() || !audioPath.empty()) recorder = std::make_unique<Recorder>(videoPath, audioPath);
+
+    // SPU output is produced on emulated time, draining it every frame keeps audio track in sync with video
+    std::vector<int16_t> samples(AudioStream::CAPACITY);
 
     while (cpu->state == mips::CPU::State::run) {
         cpu->emulateFrame();
+        if (fillStatsFile && !cpu->gpu->fillStats.overdraw.empty()) writeFillStats(fillStatsFile, cpu->gpu->frames, cpu->gpu->fillStats);
+        if (recorder && !cpu->gpu->frameSkipped) recorder->pushFrame(cpu->gpu.get());
+
+        size_t count = cpu->spu->audio->pop(samples.data(), samples.size());
+        if (recorder) recorder->pushAudio(samples.data(), count);
     }
 
+    recorder.reset();
+    if (fillStatsFile) fclose(fillStatsFile);
+
     return 0;
 }
@@ -0,0 +1,192 @@
+#include "recorder.h"
+#include <lodepng.h>
+#include <chrono>
+#include <vector>
+#include "utils/string.h"
+
+namespace {
+bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string withoutExtension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path;
+    return path.substr(0, dot);
+}
+
+void put16(FILE* f, uint16_t v) {
+    uint8_t b[] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+void put32(FILE* f, uint32_t v) {
+    put16(f, v & 0xffff);
+    put16(f, v >> 16);
+}
+}  // namespace
+
+Recorder::Recorder(const std::string& videoPath, const std::string& audioPath) : videoPath(videoPath) {
+    y4m = endsWith(videoPath, ".y4m");
+
+    if (!audioPath.empty()) {
+        audio = fopen(audioPath.c_str(), "wb");
+        if (audio) {
+            writeWavHeader();
+        } else {
+            printf("Cannot open %s\n", audioPath.c_str());
+        }
+    }
+
+    for (int i = 0; i < FRAME_SLOTS; i++) freeSlots.push(i);
+    writer = std::thread(&Recorder::writerLoop, this);
+}
+
+Recorder::~Recorder() {
+    quit = true;
+    wakeUp.notify_one();
+    writer.join();
+
+    if (video) fclose(video);
+    if (audio) {
+        // Sizes are known only now
+        fseek(audio, 0, SEEK_SET);
+        writeWavHeader();
+        fclose(audio);
+    }
+    if (droppedFrames > 0 || droppedSamples > 0) {
+        printf("Recorder: dropped %d frames, %zu audio samples\n", (int)droppedFrames, (size_t)droppedSamples);
+    }
+}
+
+void Recorder::pushFrame(GPU* gpu) {
+    if (videoPath.empty()) return;
+
+    int slot;
+    if (!freeSlots.pop(slot)) {
+        droppedFrames++;
+        return;
+    }
+    gpu->snapshotDisplay(slots[slot], false);
+    filledSlots.push(slot);
+    wakeUp.notify_one();
+}
+
+void Recorder::pushAudio(const int16_t* samples, size_t count) {
+    if (!audio) return;
+
+    size_t written = audioSamples.push(samples, count);
+    if (written < count) droppedSamples += count - written;
+    wakeUp.notify_one();
+}
+
+void Recorder::writerLoop() {
+    DisplayImage image;
+    std::vector<int16_t> samples(4096);
+
+    for (;;) {
+        bool idle = true;
+
+        int slot;
+        while (filledSlots.pop(slot)) {
+            convertDisplay(slots[slot], image);
+            int frameCycles = slots[slot].frameCycles;
+            freeSlots.push(slot);
+            writeFrame(image, frameCycles);
+            idle = false;
+        }
+
+        size_t count;
+        while ((count = audioSamples.pop(samples.data(), samples.size())) > 0) {
+            // WAV samples are little endian, as are all supported hosts
+            fwrite(samples.data(), sizeof(int16_t), count, audio);
+            audioBytes += count * sizeof(int16_t);
+            idle = false;
+        }
+
+        if (idle) {
+            // Everything queued before quit was set is written by now
+            if (quit) return;
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+void Recorder::writeFrame(const DisplayImage& image, int frameCycles) {
+    if (image.width == 0 || image.height == 0) return;
+
+    if (y4m) {
+        writeY4m(image, frameCycles);
+    } else {
+        writePng(image);
+    }
+    frame++;
+}
+
+void Recorder::writeY4m(const DisplayImage& image, int frameCycles) {
+    if (videoError) return;
+    if (video && (image.width != videoWidth || image.height != videoHeight || frameCycles != videoFrameCycles)) {
+        fclose(video);
+        video = nullptr;
+        segment++;
+    }
+
+    if (!video) {
+        std::string path = segment == 0 ? videoPath : string_format("%s_%d.y4m", withoutExtension(videoPath).c_str(), segment);
+        video = fopen(path.c_str(), "wb");
+        if (!video) {
+            printf("Cannot open %s\n", path.c_str());
+            videoError = true;
+            return;
+        }
+        videoWidth = image.width;
+        videoHeight = image.height;
+        videoFrameCycles = frameCycles;
+        // Frame rate of emulated (not nominal 60/50 Hz) timing, so video stays in sync with audio produced in the same emulated time
+        fprintf(video, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n", videoWidth, videoHeight, CPU_CLOCK, videoFrameCycles);
+    }
+
+    // BT.601 limited range, planes of full resolution
+    const size_t pixels = image.width * image.height;
+    std::vector<uint8_t> planes(pixels * 3);
+    for (size_t i = 0; i < pixels; i++) {
+        int r = image.rgb[i * 3 + 0];
+        int g = image.rgb[i * 3 + 1];
+        int b = image.rgb[i * 3 + 2];
+        planes[i] = (uint8_t)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+        planes[pixels + i] = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+        planes[pixels * 2 + i] = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+    }
+
+    fputs("FRAME\n", video);
+    fwrite(planes.data(), 1, planes.size(), video);
+}
+
+void Recorder::writePng(const DisplayImage& image) {
+    std::string path = string_format("%s_%06d.png", withoutExtension(videoPath).c_str(), frame);
+    unsigned error = lodepng::encode(path, image.rgb, image.width, image.height, LCT_RGB);
+    if (error) printf("Cannot write %s: %s\n", path.c_str(), lodepng_error_text(error));
+}
+
+void Recorder::writeWavHeader() {
+    const int channels = 2;
+    const int bytesPerSample = sizeof(int16_t);
+
+    fwrite("RIFF", 1, 4, audio);
+    put32(audio, 36 + audioBytes);
+    fwrite("WAVE", 1, 4, audio);
+
+    fwrite("fmt ", 1, 4, audio);
+    put32(audio, 16);
+    put16(audio, 1);  // PCM
+    put16(audio, channels);
+    put32(audio, AUDIO_RATE);
+    put32(audio, AUDIO_RATE * channels * bytesPerSample);
+    put16(audio, channels * bytesPerSample);
+    put16(audio, bytesPerSample * 8);
+
+    fwrite("data", 1, 4, audio);
+    put32(audio, audioBytes);
+}
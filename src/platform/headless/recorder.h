@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "device/gpu/display.h"
+#include "utils/ring_buffer.h"
+
+/**
+ * Writes presented frames to Y4M file or PNG sequence and audio to WAV file.
+ * Conversion, encoding and file I/O happen on a background thread, emulation thread only copies
+ * display area into a free slot. When the writer falls behind, frames and audio are dropped (and counted)
+ * instead of stalling emulation.
+ */
+class Recorder {
+   public:
+    static const int FRAME_SLOTS = 8;
+    static const size_t AUDIO_SAMPLES = 1 << 18;  // 16 bit samples, about 3 seconds of 44.1 kHz stereo
+    static const int AUDIO_RATE = 44100;
+
+    // videoPath ending with .y4m is written as Y4M stream, anything else as PNG sequence (path_000000.png).
+    // Empty path disables given output.
+    Recorder(const std::string& videoPath, const std::string& audioPath);
+    ~Recorder();
+
+    // Call after each presented frame (not for frames dropped by frameskip)
+    void pushFrame(GPU* gpu);
+    // Interleaved stereo samples
+    void pushAudio(const int16_t* samples, size_t count);
+
+    int getDroppedFrames() const { return droppedFrames; }
+    size_t getDroppedSamples() const { return droppedSamples; }
+
+   private:
+    std::string videoPath;
+    bool y4m = false;
+    FILE* video = nullptr;
+    FILE* audio = nullptr;
+
+    // Slot indices passed between threads, free ones go back from writer to emulation thread
+    std::array<DisplaySnapshot, FRAME_SLOTS> slots;
+    utils::RingBuffer<int, FRAME_SLOTS> freeSlots;
+    utils::RingBuffer<int, FRAME_SLOTS> filledSlots;
+    utils::RingBuffer<int16_t, AUDIO_SAMPLES> audioSamples;
+
+    std::atomic<int> droppedFrames{0};
+    std::atomic<size_t> droppedSamples{0};
+
+    // Owned by writer thread
+    int frame = 0;
+    int segment = 0;  // Y4M stream is restarted in new file when resolution or frame rate changes
+    int videoWidth = 0;
+    int videoHeight = 0;
+    int videoFrameCycles = 0;
+    bool videoError = false;
+    size_t audioBytes = 0;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::atomic<bool> quit{false};
+
+    void writerLoop();
+    void writeFrame(const DisplayImage& image, int frameCycles);
+    void writeY4m(const DisplayImage& image, int frameCycles);
+    void writePng(const DisplayImage& image);
+    void writeWavHeader();
+};
@@ -23,7 +23,19 @@ const json defaultConfig = {
 		{"r2",      "Keypad *"},
 		{"select",  "Right Shift"},
 		{"start",   "Return"},
-	}}
+	}},
+	{"options", {
+		{"graphics", {
+			{"renderer", "software"}, // software or opengl
+			{"threaded", false},
+			{"presentationThread", false},
+			{"frameskip", 0},
+			{"frameCache", true},
+		}},
+		{"cdrom", {
+			{"speed", 1}, // read speed multiplier: 1 (accurate), 2, 4, 8 or 0 (instant)
+		}},
+	}},
 };
 // clang-format on
 
@@ -31,31 +43,42 @@ json config = defaultConfig;
 
 void saveConfigFile(const char* configName) { putFileContents(configName, config.dump(4)); }
 
-void loadConfigFile(const char* configName) {
-    auto file = getFileContents(configName);
-    if (file.empty()) {
-        saveConfigFile(configName);
-        return;
-    }
-    nlohmann::json newconfig = json::parse(file.begin(), file.end());
-
-    for (auto it = config.begin(); it != config.end(); ++it) {
+// Nested objects are repaired recursively
+static void repairConfig(json& newconfig, const json& defaults, const std::string& path = "") {
+    for (auto it = defaults.begin(); it != defaults.end(); ++it) {
         auto field = newconfig.find(it.key());
+        std::string name = path + it.key();
 
         // Add nonexisting fields
         if (field == newconfig.end()) {
-            printf("Config: No field %s \n", it.key().c_str());
+            printf("Config: No field %s \n", name.c_str());
             newconfig.emplace(it.key(), it.value());
             continue;
         }
 
         // Repair these with invalid types
         if (field.value().type() != it.value().type()) {
-            printf("Config: Invalid type of %s (%s), changing to %s\n", field.key().c_str(), field.value().type_name().c_str(),
+            printf("Config: Invalid type of %s (%s), changing to %s\n", name.c_str(), field.value().type_name().c_str(),
                    it.value().type_name().c_str());
             newconfig[it.key()] = it.value();
+            continue;
+        }
+
+        if (it.value().is_object()) {
+            repairConfig(field.value(), it.value(), name + ".");
         }
     }
+}
+
+void loadConfigFile(const char* configName) {
+    auto file = getFileContents(configName);
+    if (file.empty()) {
+        saveConfigFile(configName);
+        return;
+    }
+    nlohmann::json newconfig = json::parse(file.begin(), file.end());
+
+    repairConfig(newconfig, config);
 
     config = newconfig;
 }
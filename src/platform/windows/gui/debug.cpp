@@ -1,5 +1,6 @@
 #include <imgui.h>
 #include <json.hpp>
+#include <algorithm>
 #include <vector>
 #include "../../../cpu/gte/gte.h"
 #include "debugger/debugger.h"
@@ -11,6 +12,7 @@ extern bool showVramWindow;
 extern bool showDisassemblyWindow;
 extern bool showBreakpointsWindow;
 extern bool showWatchWindow;
+extern bool showFillRateWindow;
 
 struct Watch {
     uint32_t address;
@@ -45,8 +47,11 @@ const char *mapIo(uint32_t address) {
 }
 
 void replayCommands(GPU *gpu, int to) {
+    // Queued commands and pending primitives would land on top of restored VRAM
+    gpu->flush();
     auto commands = gpu->gpuLogList;
     gpu->vram = gpu->prevVram;
+    gpu->markVramDirty(0, 0, VRAM_WIDTH, VRAM_HEIGHT);
 
     gpu->gpuLogEnabled = false;
     for (int i = 0; i <= to; i++) {
@@ -67,6 +72,7 @@ void replayCommands(GPU *gpu, int to) {
             gpu->write(0, arg);
         }
     }
+    gpu->flush();
     gpu->gpuLogEnabled = true;
 }
 
@@ -215,6 +221,9 @@ void gpuLogWindow(mips::CPU *cpu) {
     if (!gpuLogEnabled) {
         return;
     }
+    // Log is appended by GPU thread and dump reads VRAM, both have to be finished
+    cpu->gpu->flush();
+
     ImGui::Begin("GPU Log", &gpuLogEnabled, ImVec2(300, 400));
 
     ImGui::BeginChild("GPU Log", ImVec2(0, -ImGui::GetItemsLineHeightWithSpacing()), false);
@@ -267,8 +276,10 @@ void gpuLogWindow(mips::CPU *cpu) {
             putFileContents(string_format("%s.json", filename), j.dump(2));
 
             // Binary vram dump
+            std::vector<uint16_t> pixels(VRAM_WIDTH * VRAM_HEIGHT);
+            gpu->readVram(0, 0, VRAM_WIDTH, VRAM_HEIGHT, pixels.data());
             std::vector<uint8_t> vram;
-            vram.assign(gpu->vram.data(), gpu->vram.data() + (VRAM_WIDTH * VRAM_HEIGHT));
+            vram.assign((uint8_t*)pixels.data(), (uint8_t*)(pixels.data() + pixels.size()));
             putFileContents(string_format("%s.bin", filename), vram);
 
             ImGui::CloseCurrentPopup();
@@ -290,6 +301,65 @@ void gpuLogWindow(mips::CPU *cpu) {
     }
 }
 
+void fillRateWindow(mips::CPU *cpu) {
+    ImGui::Begin("GPU fill rate", &showFillRateWindow, ImVec2(540, 480));
+
+    auto gpu = cpu->gpu.get();
+    const FillStats &stats = gpu->fillStats;
+    if (gpu->hardwareRenderer) {
+        ImGui::Text("Not available with hardware renderer");
+    } else if (stats.overdraw.empty()) {
+        ImGui::Text("Waiting for frame");
+    } else {
+        auto percent = [](uint64_t part, uint64_t whole) { return whole ? part * 100.0 / whole : 0.0; };
+
+        ImGui::Columns(2, nullptr, false);
+        ImGui::Text("Polygons:   %d", stats.polygons);
+        ImGui::Text("Rectangles: %d", stats.rectangles);
+        ImGui::Text("Lines:      %d", stats.lines);
+        ImGui::Text("Fills:      %d", stats.fills);
+        ImGui::NextColumn();
+        ImGui::Text("Pixels tested:  %llu", (unsigned long long)stats.pixelsTested);
+        ImGui::Text("Pixels written: %llu (%.1f%% of tested)", (unsigned long long)stats.pixelsWritten,
+                    percent(stats.pixelsWritten, stats.pixelsTested));
+        ImGui::Text("Textured:       %.1f%%", percent(stats.pixelsTextured, stats.pixelsWritten));
+        ImGui::Text("Blended:        %.1f%%", percent(stats.pixelsBlended, stats.pixelsWritten));
+        ImGui::Columns(1);
+        ImGui::Separator();
+
+        // Heatmap of VRAM, cells are 8x8 pixels colored by average number of writes
+        const int cellSize = 8;
+        const int cellsX = VRAM_WIDTH / cellSize;
+        const int cellsY = VRAM_HEIGHT / cellSize;
+        std::vector<float> cells = stats.heatmap(cellSize);
+        float maxCell = 0.f;
+        for (float cell : cells) maxCell = std::max(maxCell, cell);
+        ImGui::Text("Overdraw (max %.1f writes per pixel in 8x8 block)", maxCell);
+
+        float scale = std::max(ImGui::GetContentRegionAvailWidth(), 1.f) / VRAM_WIDTH;
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        ImDrawList *drawList = ImGui::GetWindowDrawList();
+        drawList->AddRectFilled(origin, ImVec2(origin.x + VRAM_WIDTH * scale, origin.y + VRAM_HEIGHT * scale), IM_COL32(0, 0, 0, 255));
+        for (int y = 0; y < cellsY; y++) {
+            for (int x = 0; x < cellsX; x++) {
+                float cell = cells[y * cellsX + x];
+                if (cell == 0.f) continue;
+
+                // Blue for single write through red to yellow for the most overdrawn block
+                float t = maxCell > 1.f ? std::min(std::max((cell - 1.f) / (maxCell - 1.f), 0.f), 1.f) : 0.f;
+                ImU32 color = t < 0.5f ? ImColor(t * 2.f, 0.f, 1.f - t * 2.f) : ImColor(1.f, t * 2.f - 1.f, 0.f);
+
+                ImVec2 min = ImVec2(origin.x + x * cellSize * scale, origin.y + y * cellSize * scale);
+                ImVec2 max = ImVec2(min.x + cellSize * scale, min.y + cellSize * scale);
+                drawList->AddRectFilled(min, max, color);
+            }
+        }
+        ImGui::Dummy(ImVec2(VRAM_WIDTH * scale, VRAM_HEIGHT * scale));
+    }
+
+    ImGui::End();
+}
+
 void ioWindow(mips::CPU *cpu) {
     if (!showIo) {
         return;
@@ -44,6 +44,21 @@ void cdromWindow(mips::CPU *cpu) {
         ImGui::PopStyleVar();
 
         ImGui::Checkbox("Use LBA", &useLba);
+
+        if (auto disc = cpu->cdrom->disc) {
+            auto stats = disc->getPrefetchStats();
+            uint64_t reads = stats.hits + stats.misses;
+            ImGui::Text("Read-ahead: %llu hits, %llu misses (%.1f%% hit rate)", (unsigned long long)stats.hits,
+                        (unsigned long long)stats.misses, reads ? 100.0 * stats.hits / reads : 0.0);
+            ImGui::SameLine();
+            if (ImGui::Button("Reset")) disc->resetPrefetchStats();
+        }
+
+        auto audio = cpu->spu->audio->getStats();
+        ImGui::Text("Audio: %llu underruns, %llu samples dropped, %.1f ms buffered, rate %.4f", (unsigned long long)audio.underruns,
+                    (unsigned long long)audio.overruns, audio.buffered / 2 * 1000.0 / AudioStream::SAMPLE_RATE, audio.ratio);
+        ImGui::SameLine();
+        if (ImGui::Button("Reset##audio")) cpu->spu->audio->resetStats();
     }
     ImGui::End();
 }
\ No newline at end of file
@@ -11,6 +11,7 @@ void gteRegistersWindow(GTE gte);
 void ioLogWindow(mips::CPU* cpu);
 void gteLogWindow(mips::CPU* cpu);
 void gpuLogWindow(mips::CPU* cpu);
+void fillRateWindow(mips::CPU* cpu);
 void ioWindow(mips::CPU* cpu);
 void vramWindow();
 void disassemblyWindow(mips::CPU* cpu);
@@ -39,6 +40,7 @@ bool showBreakpointsWindow = false;
 bool showWatchWindow = false;
 bool showRamWindow = false;
 bool showCdromWindow = false;
+bool showFillRateWindow = false;
 
 void renderImgui(mips::CPU* cpu) {
     if (ImGui::BeginMainMenuBar()) {
@@ -69,6 +71,7 @@ void renderImgui(mips::CPU* cpu) {
 #endif
             ImGui::MenuItem("GTE log", nullptr, &gteLogEnabled);
             ImGui::MenuItem("GPU log", nullptr, &gpuLogEnabled);
+            ImGui::MenuItem("GPU fill rate", nullptr, &showFillRateWindow);
 
             ImGui::Separator();
 
@@ -85,6 +88,16 @@ void renderImgui(mips::CPU* cpu) {
         if (ImGui::BeginMenu("Options")) {
             if (ImGui::MenuItem("BIOS", nullptr)) showBiosWindow = true;
             if (ImGui::MenuItem("Controller", nullptr)) showControllerSetupWindow = true;
+            if (ImGui::BeginMenu("CD-ROM speed")) {
+                const std::pair<const char*, int> speeds[] = {{"Accurate", 1}, {"2x", 2}, {"4x", 4}, {"8x", 8}, {"Instant", 0}};
+                for (auto& speed : speeds) {
+                    if (ImGui::MenuItem(speed.first, nullptr, cpu->cdrom->speedMultiplier == speed.second)) {
+                        cpu->cdrom->speedMultiplier = speed.second;
+                        config["options"]["cdrom"]["speed"] = speed.second;
+                    }
+                }
+                ImGui::EndMenu();
+            }
             ImGui::EndMenu();
         }
         ImGui::EndMainMenuBar();
@@ -97,6 +110,8 @@ void renderImgui(mips::CPU* cpu) {
     if (ioLogEnabled) ioLogWindow(cpu);
     if (gteLogEnabled) gteLogWindow(cpu);
     if (gpuLogEnabled) gpuLogWindow(cpu);
+    cpu->gpu->fillStatsEnabled = showFillRateWindow;
+    if (showFillRateWindow) fillRateWindow(cpu);
     if (showIo) ioWindow(cpu);
     if (showRamWindow) ramWindow(cpu);
     if (showVramWindow) vramWindow();
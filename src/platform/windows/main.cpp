@@ -1,8 +1,11 @@
 #include <SDL.h>
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <json.hpp>
+#include <mutex>
 #include <string>
+#include <thread>
 #include "imgui/imgui_impl_sdl_gl3.h"
 #include "mips.h"
 #include "platform/windows/config.h"
@@ -12,10 +15,10 @@
 #include "utils/cue/cueParser.h"
 #include "utils/file.h"
 #include "utils/string.h"
+#include "utils/triple_buffer.h"
 
 #undef main
 
-const int CPU_CLOCK = 33868500;
 const int GPU_CLOCK_NTSC = 53690000;
 
 device::controller::DigitalController& getButtonState(SDL_Event& event) {
@@ -137,11 +140,12 @@ void loadFile(std::unique_ptr<mips::CPU>& cpu, std::string path) {
         }
     } else if (ext == "iso" || ext == "bin" || ext == "img") {
         cue = utils::Cue::fromBin(path.c_str());
+    } else if (ext == "cdz") {
+        cue = utils::Cue::fromCdz(path.c_str());
     }
 
     if (cue != nullptr) {
-        cpu->cdrom->cue = *cue;
-        bool success = dynamic_cast<device::dma::dmaChannel::DMA3Channel*>(cpu->dma->dma[3].get())->load(cue->tracks[0].filename);
+        bool success = cpu->cdrom->insertDisc(*cue);
         cpu->cdrom->setShell(!success);
         printf("File %s loaded\n", getFilenameExt(path).c_str());
     }
@@ -149,8 +153,17 @@ void loadFile(std::unique_ptr<mips::CPU>& cpu, std::string path) {
 
 std::unique_ptr<mips::CPU> cpu;
 
-void hardReset() {
+void hardReset(OpenGL& opengl) {
     cpu = std::make_unique<mips::CPU>();
+    cpu->gpu->setThreaded(config["options"]["graphics"]["threaded"]);
+    cpu->gpu->frameskip = config["options"]["graphics"]["frameskip"];
+    cpu->gpu->frameCaching = config["options"]["graphics"]["frameCache"];
+    cpu->cdrom->speedMultiplier = config["options"]["cdrom"]["speed"];
+    AudioCD::setStream(cpu->spu->audio);
+
+    // Hardware renderer disables threaded mode, graphics context belongs to this thread
+    std::string renderer = config["options"]["graphics"]["renderer"];
+    opengl.setHardwareRendering(cpu->gpu.get(), renderer == "opengl");
 
     std::string bios = config["bios"];
     if (!bios.empty() && cpu->loadBios(bios)) {
@@ -170,7 +183,8 @@ void hardReset() {
 }
 
 // Warning: this method might have 1 or more miliseconds of inaccuracy.
-void limitFramerate(SDL_Window* window, bool framelimiter) {
+// Returns framerate measured over last 250 ms
+double limitFramerate(bool framelimiter) {
     static double counterFrequency = SDL_GetPerformanceFrequency();
     static double startTime = SDL_GetPerformanceCounter() / counterFrequency;
     static double fps;
@@ -197,18 +211,45 @@ void limitFramerate(SDL_Window* window, bool framelimiter) {
         fps = (double)deltaFrames / fpsTime;
         deltaFrames = 0;
         fpsTime = 0.0;
+    }
+    return fps;
+}
+
+void updateWindowTitle(SDL_Window* window, double fps, bool framelimiter) {
+    static double lastFps = -1.0;
+    if (fps == lastFps) return;
+    lastFps = fps;
 
-        // TODO: Move this part outside method
-        std::string gameName;
-        if (cpu->cdrom->cue.file.empty())
-            gameName = "No CD";
-        else
-            gameName = getFilename(cpu->cdrom->cue.file);
+    std::string gameName;
+    if (cpu->cdrom->cue.file.empty())
+        gameName = "No CD";
+    else
+        gameName = getFilename(cpu->cdrom->cue.file);
+
+    std::string title = string_format("Avocado: %s - FPS: %.0f (%0.2f ms) %s", gameName.c_str(), fps, (1.0 / fps) * 1000.0,
+                                      !framelimiter ? "unlimited" : "");
+    SDL_SetWindowTitle(window, title.c_str());
+}
 
-        std::string title = string_format("Avocado: %s - FPS: %.0f (%0.2f ms) %s", gameName.c_str(), fps, (1.0 / fps) * 1000.0,
-                                          !framelimiter ? "unlimited" : "");
-        SDL_SetWindowTitle(window, title.c_str());
+// Emulate one frame if running, returns false if it shouldn't be presented
+bool runFrame() {
+    if (cpu->state == mips::CPU::State::run) {
+        cpu->emulateFrame();
+        if (singleFrame) {
+            singleFrame = false;
+            cpu->state = mips::CPU::State::pause;
+        }
+
+        // Skipped frame is not presented, its drawing stays deferred.
+        // GPU thread is still synced, GUI reads GPU state once this returns.
+        if (cpu->state == mips::CPU::State::run && cpu->gpu->frameSkipped) {
+            cpu->gpu->sync();
+            return false;
+        }
     }
+
+    cpu->gpu->flush();
+    return true;
 }
 
 int main(int argc, char** argv) {
@@ -245,7 +286,7 @@ int main(int argc, char** argv) {
 
     AudioCD::init();
 
-    hardReset();
+    hardReset(opengl);
 
     SDL_EventState(SDL_DROPFILE, SDL_ENABLE);
     SDL_GameControllerEventState(SDL_ENABLE);
@@ -254,7 +295,13 @@ int main(int argc, char** argv) {
     ImGui_ImplSdlGL3_Init(window);
     ImGui::StyleColorsDark();
 
-    SDL_GL_SetSwapInterval(0);
+    // Emulation on separate thread publishes display snapshots, this one only presents them (and runs GUI).
+    // Hardware renderer needs GP0 commands executed on thread owning graphics context.
+    std::string renderer = config["options"]["graphics"]["renderer"];
+    bool presentationThread = config["options"]["graphics"]["presentationThread"] && renderer != "opengl";
+
+    // Emulation thread isn't paced by vsync
+    SDL_GL_SetSwapInterval(presentationThread ? 1 : 0);
 
     vramTextureId = opengl.getVramTextureId();
     if (!isEmulatorConfigured())
@@ -265,8 +312,38 @@ int main(int argc, char** argv) {
     bool frameLimitEnabled = true;
     bool windowFocused = true;
 
+    // Held while emulating a frame and whenever this thread touches emulator state
+    std::mutex emulationMutex;
+    utils::TripleBuffer<DisplaySnapshot> display;
+    bool snapshotFullVram = false;
+    std::atomic<double> emulationFps{0.0};
+    std::atomic<bool> emulationExit{false};
+    std::thread emulationThread;
+
+    if (presentationThread) {
+        emulationThread = std::thread([&] {
+            while (!emulationExit) {
+                bool framelimiter;
+                {
+                    std::lock_guard<std::mutex> lock(emulationMutex);
+                    framelimiter = frameLimitEnabled;
+                    if (runFrame()) {
+                        cpu->gpu->snapshotDisplay(display.backBuffer(), snapshotFullVram);
+                        display.publish();
+                    }
+                }
+                emulationFps = limitFramerate(framelimiter);
+
+                // Unlimited emulation would grab the lock again right away
+                if (!framelimiter) std::this_thread::yield();
+            }
+        });
+    }
+
     SDL_Event event;
     while (running && !exitProgram) {
+        std::unique_lock<std::mutex> lock(emulationMutex);
+
         bool newEvent = false;
         if (cpu->state != mips::CPU::State::run && !windowFocused) {
             SDL_WaitEvent(&event);
@@ -344,24 +421,42 @@ int main(int argc, char** argv) {
 
         if (doHardReset) {
             doHardReset = false;
-            hardReset();
+            hardReset(opengl);
         }
 
-        if (cpu->state == mips::CPU::State::run) {
-            cpu->emulateFrame();
-            if (singleFrame) {
-                singleFrame = false;
-                cpu->state = mips::CPU::State::pause;
+        if (!presentationThread) {
+            if (runFrame()) {
+                ImGui_ImplSdlGL3_NewFrame(window);
+
+                opengl.render(cpu->gpu.get());
+                renderImgui(cpu.get());
+
+                SDL_GL_SwapWindow(window);
             }
+
+            updateWindowTitle(window, limitFramerate(frameLimitEnabled), frameLimitEnabled);
+            continue;
         }
-        ImGui_ImplSdlGL3_NewFrame(window);
 
-        opengl.render(cpu->gpu.get());
+        // Present most recent frame without stopping emulation, GUI reads emulator state so it is built with the lock held
+        snapshotFullVram = showVRAM;
+        lock.unlock();
+
+        display.update();
+        opengl.render(display.frontBuffer());
+
+        lock.lock();
+        ImGui_ImplSdlGL3_NewFrame(window);
         renderImgui(cpu.get());
+        updateWindowTitle(window, emulationFps, frameLimitEnabled);
+        lock.unlock();
 
         SDL_GL_SwapWindow(window);
+    }
 
-        limitFramerate(window, frameLimitEnabled);
+    if (emulationThread.joinable()) {
+        emulationExit = true;
+        emulationThread.join();
     }
     saveConfigFile(CONFIG_NAME);
 
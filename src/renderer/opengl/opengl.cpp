@@ -1,6 +1,8 @@
 #include "opengl.h"
 #include <SDL.h>
 #include <glad/glad.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include "shader/Program.h"
 #include "device/gpu/gpu.h"
@@ -38,7 +40,7 @@ void OpenGL::createRenderBuffer() {
 
     glGenBuffers(1, &renderVbo);
     glBindBuffer(GL_ARRAY_BUFFER, renderVbo);
-    glBufferData(GL_ARRAY_BUFFER, bufferSize * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, bufferSize * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
 
     renderShader->getAttrib("position").pointer(2, GL_INT, sizeof(Vertex), 0);
     renderShader->getAttrib("color").pointer(3, GL_UNSIGNED_INT, sizeof(Vertex), 2 * sizeof(int));
@@ -133,31 +135,324 @@ bool OpenGL::setup() {
     createBlitBuffer();
     createVramTexture();
     createRenderTexture();
+    createUploadBuffers();
+
+    // VRAM areas are transferred as tightly packed rows of 16 bit pixels
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glPixelStorei(GL_PACK_ALIGNMENT, 2);
 
     return true;
 }
 
-void OpenGL::renderFirstStage(const std::vector<Vertex> &renderList, GPU *gpu) {
-    // First stage - render calls to VRAM
-    if (renderList.empty()) {
+void OpenGL::createUploadBuffers() {
+    glGenBuffers(UPLOAD_BUFFERS, uploadPbo);
+    for (GLuint pbo : uploadPbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, VRAM_WIDTH * VRAM_HEIGHT * sizeof(uint16_t), nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void OpenGL::uploadVram(GPU *gpu) {
+    struct Area {
+        int x, y, w, h;
+        size_t offset;
+    };
+
+    VramDirtyMap dirty = gpu->takeVramDirty(GPU::VramConsumer::Renderer);
+    if (dirty.empty()) return;
+
+    const GLsizeiptr size = VRAM_WIDTH * VRAM_HEIGHT * sizeof(uint16_t);
+    int index = uploadIndex;
+    uploadIndex = (uploadIndex + 1) % UPLOAD_BUFFERS;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadPbo[index]);
+    if (uploadFence[index] != nullptr) {
+        // Driver is still reading previous upload from this buffer - orphan it instead of waiting
+        if (glClientWaitSync(uploadFence[index], 0, 0) == GL_TIMEOUT_EXPIRED) {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+        glDeleteSync(uploadFence[index]);
+        uploadFence[index] = nullptr;
+    }
+
+    auto buffer = (uint16_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (buffer == nullptr) {
+        // Mapping failed, upload from client memory
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, renderTex);
+        dirty.forEachArea([&](int x, int y, int w, int h) {
+            staging.resize(w * h);
+            gpu->readVram(x, y, w, h, staging.data());
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, staging.data());
+        });
+        return;
+    }
+
+    // Areas are disjoint, packed one after another they always fit in VRAM sized buffer
+    std::vector<Area> areas;
+    size_t offset = 0;
+    dirty.forEachArea([&](int x, int y, int w, int h) {
+        gpu->readVram(x, y, w, h, &buffer[offset]);
+        areas.push_back({x, y, w, h, offset});
+        offset += w * h;
+    });
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(GL_TEXTURE_2D, renderTex);
+    for (auto &a : areas) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, a.x, a.y, a.w, a.h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                        (const void *)(a.offset * sizeof(uint16_t)));
+    }
+    uploadFence[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+namespace {
+// Split area wrapping around VRAM edges into up to four rectangles
+template <typename F>
+void forEachWrappedArea(int x, int y, int w, int h, F fn) {
+    x &= VRAM_WIDTH - 1;
+    y &= VRAM_HEIGHT - 1;
+    w = std::min(w, VRAM_WIDTH);
+    h = std::min(h, VRAM_HEIGHT);
+    if (w <= 0 || h <= 0) return;
+
+    int w0 = std::min(w, VRAM_WIDTH - x);
+    int h0 = std::min(h, VRAM_HEIGHT - y);
+    fn(x, y, w0, h0);
+    if (w0 < w) fn(0, y, w - w0, h0);
+    if (h0 < h) fn(x, 0, w0, h - h0);
+    if (w0 < w && h0 < h) fn(0, 0, w - w0, h - h0);
+}
+}  // namespace
+
+void OpenGL::setHardwareRendering(GPU *gpu, bool enabled) {
+    flush();
+    if (!enabled) {
+        if (gpu->hardwareRenderer == this) {
+            // Bring software VRAM up to date before rasterizer takes over
+            vramRead(gpu, 0, 0, VRAM_WIDTH, VRAM_HEIGHT);
+            gpu->markVramDirty(0, 0, VRAM_WIDTH, VRAM_HEIGHT);
+        }
+        gpu->hardwareRenderer = nullptr;
+        return;
+    }
+
+    // Graphics context belongs to emulation thread
+    gpu->setThreaded(false);
+    gpu->flush();
+    gpu->hardwareRenderer = this;
+    vramWritten(gpu, 0, 0, VRAM_WIDTH, VRAM_HEIGHT);
+}
+
+void OpenGL::addToBatch(GPU *gpu, const Vertex *v, int count) {
+    BatchState state;
+    state.drawingOffsetX = gpu->drawingOffsetX;
+    state.drawingOffsetY = gpu->drawingOffsetY;
+    state.drawingAreaLeft = gpu->drawingAreaLeft;
+    state.drawingAreaTop = gpu->drawingAreaTop;
+    state.drawingAreaRight = gpu->drawingAreaRight;
+    state.drawingAreaBottom = gpu->drawingAreaBottom;
+    state.transparency = (v[0].flags & Vertex::SemiTransparency) ? v[0].transparency() : -1;
+    state.maskedBlending = state.transparency >= 0 && v[0].bitcount != 0;
+    state.textureWindow = gpu->gp0_e2._reg;
+
+    if (!batch.empty() && (state != batchState || batch.size() + count > (size_t)bufferSize)) flush();
+
+    // Texture or palette drawn earlier in this batch - sampled copy of VRAM must be updated first
+    int bits = v[0].bitcount;
+    if (bits != 0) {
+        bool sampled = batchWritten.intersects(v[0].texpage[0], v[0].texpage[1], 256 * bits / 16, 256);
+        if (bits != 16) sampled |= batchWritten.intersects(v[0].clut[0], v[0].clut[1], 1 << bits, 1);
+        if (sampled) flush();
+    }
+    batchState = state;
+
+    int minX = VRAM_WIDTH, minY = VRAM_HEIGHT, maxX = 0, maxY = 0;
+    for (int i = 0; i < count; i++) {
+        minX = std::min(minX, v[i].position[0] + state.drawingOffsetX);
+        minY = std::min(minY, v[i].position[1] + state.drawingOffsetY);
+        maxX = std::max(maxX, v[i].position[0] + state.drawingOffsetX);
+        maxY = std::max(maxY, v[i].position[1] + state.drawingOffsetY);
+    }
+    minX = gpu->minDrawingX(minX);
+    minY = gpu->minDrawingY(minY);
+    maxX = std::min({maxX, (int)state.drawingAreaRight, VRAM_WIDTH - 1});
+    maxY = std::min({maxY, (int)state.drawingAreaBottom, VRAM_HEIGHT - 1});
+    if (minX > maxX || minY > maxY) return;
+
+    // Masked batch is drawn in two passes, overlapping primitives would end up in wrong order
+    if (state.maskedBlending && !batch.empty() && batchWritten.intersects(minX, minY, maxX - minX + 1, maxY - minY + 1)) flush();
+    batchWritten.mark(minX, minY, maxX - minX + 1, maxY - minY + 1);
+
+    batch.insert(batch.end(), v, v + count);
+}
+
+void OpenGL::drawTriangle(GPU *gpu, const Vertex v[3]) { addToBatch(gpu, v, 3); }
+
+void OpenGL::drawLine(GPU *gpu, const int16_t x[2], const int16_t y[2], const RGB c[2], int flags) {
+    // One pixel wide quad along major axis, first two corners are at the start
+    int x0 = x[0], y0 = y[0], x1 = x[1], y1 = y[1];
+    RGB c0 = c[0], c1 = (flags & Vertex::GouroudShading) ? c[1] : c[0];
+    bool steep = std::abs(x1 - x0) < std::abs(y1 - y0);
+    if ((!steep && x0 > x1) || (steep && y0 > y1)) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        std::swap(c0, c1);
+    }
+
+    int corners[4][2];
+    if (!steep) {
+        int quad[4][2] = {{x0, y0}, {x0, y0 + 1}, {x1 + 1, y1}, {x1 + 1, y1 + 1}};
+        memcpy(corners, quad, sizeof(quad));
+    } else {
+        int quad[4][2] = {{x0, y0}, {x0 + 1, y0}, {x1, y1 + 1}, {x1 + 1, y1 + 1}};
+        memcpy(corners, quad, sizeof(quad));
+    }
+
+    // Lines always blend using mode from E1
+    flags |= (int)gpu->gp0_e1.semiTransparency << Vertex::TRANSPARENCY_SHIFT;
+    Vertex v[6];
+    int order[6] = {0, 1, 2, 1, 2, 3};
+    for (int i = 0; i < 6; i++) {
+        const RGB& color = order[i] < 2 ? c0 : c1;
+        v[i] = {{corners[order[i]][0], corners[order[i]][1]}, {color.r, color.g, color.b}, {0, 0}, 0, {0, 0}, {0, 0}, flags};
+    }
+    addToBatch(gpu, v, 6);
+}
+
+void OpenGL::fill(int x, int y, int w, int h, uint16_t color) {
+    if (w <= 0 || h <= 0) return;
+    flush();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x, y, w, h);
+    glClearColor((color & 0x1f) / 31.f, ((color >> 5) & 0x1f) / 31.f, ((color >> 10) & 0x1f) / 31.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    VramDirtyMap area;
+    area.mark(x, y, w, h);
+    copyToVramTexture(area);
+}
+
+void OpenGL::vramWritten(GPU *gpu, int x, int y, int w, int h) {
+    flush();
+
+    forEachWrappedArea(x, y, w, h, [&](int x, int y, int w, int h) {
+        staging.resize(w * h);
+        gpu->readVram(x, y, w, h, staging.data());
+        for (GLuint tex : {renderTex, vramTex}) {
+            glBindTexture(GL_TEXTURE_2D, tex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, staging.data());
+        }
+    });
+}
+
+void OpenGL::vramRead(GPU *gpu, int x, int y, int w, int h) {
+    flush();
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    forEachWrappedArea(x, y, w, h, [&](int x, int y, int w, int h) {
+        staging.resize(w * h);
+        glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, staging.data());
+        gpu->writeVram(x, y, w, h, staging.data());
+    });
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void OpenGL::flush() {
+    if (batch.empty()) return;
+
+    renderFirstStage();
+    batch.clear();
+
+    copyToVramTexture(batchWritten);
+    batchWritten.clear();
+}
+
+void OpenGL::copyToVramTexture(const VramDirtyMap &area) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindTexture(GL_TEXTURE_2D, vramTex);
+    area.forEachArea([](int x, int y, int w, int h) { glCopyTexSubImage2D(GL_TEXTURE_2D, 0, x, y, x, y, w, h); });
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void OpenGL::setBlending(int transparency) {
+    using Mode = GP0_E1::SemiTransparency;
+    if (transparency < 0) {
+        glDisable(GL_BLEND);
         return;
     }
+
+    // B - background, F - drawn pixel. Mask bit (alpha) is taken from drawn pixel
+    glEnable(GL_BLEND);
+    switch ((Mode)transparency) {
+        case Mode::Bby2plusFby2:
+            glBlendColor(0.f, 0.f, 0.f, 0.5f);
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFuncSeparate(GL_CONSTANT_ALPHA, GL_CONSTANT_ALPHA, GL_ONE, GL_ZERO);
+            break;
+        case Mode::BplusF:
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ZERO);
+            break;
+        case Mode::BminusF:
+            glBlendEquationSeparate(GL_FUNC_REVERSE_SUBTRACT, GL_FUNC_ADD);
+            glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ZERO);
+            break;
+        case Mode::BplusFby4:
+            glBlendColor(0.f, 0.f, 0.f, 0.25f);
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFuncSeparate(GL_CONSTANT_ALPHA, GL_ONE, GL_ONE, GL_ZERO);
+            break;
+    }
+}
+
+void OpenGL::renderFirstStage() {
+    // First stage - render calls to VRAM
     renderShader->use();
     glBindVertexArray(renderVao);
     glBindBuffer(GL_ARRAY_BUFFER, renderVbo);
 
-    glUniform2i(renderShader->getUniform("drawingOffset"), gpu->drawingOffsetX, gpu->drawingOffsetY);
-    glUniform2ui(renderShader->getUniform("drawingAreaTopLeft"), gpu->drawingAreaLeft, gpu->drawingAreaTop);
-    glUniform2ui(renderShader->getUniform("drawingAreaBottomRight"), gpu->drawingAreaRight, gpu->drawingAreaBottom);
+    // Orphan previous batch, driver might still be reading it
+    glBufferData(GL_ARRAY_BUFFER, bufferSize * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, batch.size() * sizeof(Vertex), batch.data());
+
+    GP0_E2 textureWindow;
+    textureWindow._reg = batchState.textureWindow;
+    glUniform2i(renderShader->getUniform("drawingOffset"), batchState.drawingOffsetX, batchState.drawingOffsetY);
+    glUniform2ui(renderShader->getUniform("drawingAreaTopLeft"), batchState.drawingAreaLeft, batchState.drawingAreaTop);
+    glUniform2ui(renderShader->getUniform("drawingAreaBottomRight"), batchState.drawingAreaRight, batchState.drawingAreaBottom);
+    glUniform2ui(renderShader->getUniform("textureWindowMask"), textureWindow.textureWindowMaskX, textureWindow.textureWindowMaskY);
+    glUniform2ui(renderShader->getUniform("textureWindowOffset"), textureWindow.textureWindowOffsetX, textureWindow.textureWindowOffsetY);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, vramTex);
 
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glDrawArrays(GL_TRIANGLES, 0, renderList.size());
+    glViewport(0, 0, VRAM_WIDTH, VRAM_HEIGHT);
+    if (batchState.maskedBlending) {
+        // Texels without mask bit are opaque, the rest is blended
+        drawBatch(1);
+        drawBatch(2);
+    } else {
+        drawBatch(0);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void OpenGL::drawBatch(int blendPass) {
+    glUniform1i(renderShader->getUniform("blendPass"), blendPass);
+    setBlending(blendPass == 1 ? -1 : batchState.transparency);
+    glDrawArrays(GL_TRIANGLES, 0, batch.size());
+    setBlending(-1);
+}
+
 void OpenGL::renderSecondStage() {
     blitShader->use();
     glBindVertexArray(blitVao);
@@ -169,8 +464,29 @@ void OpenGL::renderSecondStage() {
 }
 
 void OpenGL::render(GPU *gpu) {
-    // Update screen position
+    // Update Render texture, only areas modified since last frame.
+    // In hardware rendering it is drawn to directly and software VRAM is stale.
+    if (gpu->hardwareRenderer == this) {
+        gpu->takeVramDirty(GPU::VramConsumer::Renderer);
+    } else {
+        uploadVram(gpu);
+    }
 
+    present(gpu->displayAreaStartX, gpu->displayAreaStartY, gpu->gp1_08);
+}
+
+void OpenGL::render(const DisplaySnapshot &snapshot) {
+    glBindTexture(GL_TEXTURE_2D, renderTex);
+    if (!snapshot.pixels.empty()) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, snapshot.x, snapshot.y, snapshot.w, snapshot.h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                        snapshot.pixels.data());
+    }
+
+    present(snapshot.displayAreaStartX, snapshot.displayAreaStartY, snapshot.gp1_08);
+}
+
+void OpenGL::present(int displayAreaStartX, int displayAreaStartY, GP1_08 mode) {
+    // Update screen position
     int screenWidth = width;
     int screenHeight = height;
 
@@ -180,40 +496,14 @@ void OpenGL::render(GPU *gpu) {
         screenHeight = 512;
         bb = makeBlitBuf(0, 0, screenWidth, screenHeight);
     } else {
-        bb = makeBlitBuf(gpu->displayAreaStartX, gpu->displayAreaStartY, gpu->gp1_08.getHorizontalResoulution(),
-                         gpu->gp1_08.getVerticalResoulution());
+        bb = makeBlitBuf(displayAreaStartX, displayAreaStartY, mode.getHorizontalResoulution(), mode.getVerticalResoulution());
     }
     glBindBuffer(GL_ARRAY_BUFFER, blitVbo);
     glBufferSubData(GL_ARRAY_BUFFER, 0, bb.size() * sizeof(BlitStruct), bb.data());
 
-    // Update VRAM texture
-    //    glBindTexture(GL_TEXTURE_2D, vramTex);
-    //    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1024, 512, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, gpu->vram.data());
-
-    // Update Render texture
-    glBindTexture(GL_TEXTURE_2D, renderTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1024, 512, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, gpu->vram.data());
-
-    //    auto &renderList = gpu->render();
-
-    // Update renderlist
-    //    if (!renderList.empty()) {
-    //        glBindBuffer(GL_ARRAY_BUFFER, renderVbo);
-    //        glBufferSubData(GL_ARRAY_BUFFER, 0, renderList.size() * sizeof(Vertex), renderList.data());
-    //    }
-
-    //    glViewport(0, 0, 1024, 512);
-    //    renderFirstStage(renderList, gpu);
-
     glClearColor(0.f, 0.f, 0.f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     glViewport(0, 0, screenWidth, screenHeight);
     renderSecondStage();
-
-    // Read back rendered texture to VRAM
-    //    glBindTexture(GL_TEXTURE_2D, renderTex);
-    //    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, gpu->vram.data());
-
-    //    renderList.clear();
 }
@@ -4,7 +4,7 @@
 #include <memory>
 #include "device/gpu/gpu.h"
 
-class OpenGL {
+class OpenGL : public HardwareRenderer {
    public:
     static const int resWidth = 640;
     static const int resHeight = 480;
@@ -15,6 +15,18 @@ class OpenGL {
     bool init();
     bool setup();
     void render(GPU* gpu);
+    // Present display captured by emulation thread
+    void render(const DisplaySnapshot& snapshot);
+
+    // Draw primitives of given GPU on host GPU instead of software rasterizer
+    void setHardwareRendering(GPU* gpu, bool enabled);
+
+    void drawTriangle(GPU* gpu, const Vertex v[3]) override;
+    void drawLine(GPU* gpu, const int16_t x[2], const int16_t y[2], const RGB c[2], int flags) override;
+    void fill(int x, int y, int w, int h, uint16_t color) override;
+    void vramWritten(GPU* gpu, int x, int y, int w, int h) override;
+    void vramRead(GPU* gpu, int x, int y, int w, int h) override;
+    void flush() override;
 
     void setViewFullVram(bool v) { viewFullVram = v; }
 
@@ -29,7 +41,24 @@ class OpenGL {
         float tex[2];
     };
 
-    const int bufferSize = 1024 * 1024;
+    // GPU state shared by all primitives in a batch
+    struct BatchState {
+        int16_t drawingOffsetX, drawingOffsetY;
+        int16_t drawingAreaLeft, drawingAreaTop, drawingAreaRight, drawingAreaBottom;
+        int transparency;     // Semi transparency mode, -1 if disabled
+        bool maskedBlending;  // Semi transparent and textured, only texels with mask bit set are blended
+        uint32_t textureWindow;
+
+        bool operator==(const BatchState& o) const {
+            return drawingOffsetX == o.drawingOffsetX && drawingOffsetY == o.drawingOffsetY && drawingAreaLeft == o.drawingAreaLeft
+                   && drawingAreaTop == o.drawingAreaTop && drawingAreaRight == o.drawingAreaRight
+                   && drawingAreaBottom == o.drawingAreaBottom && transparency == o.transparency && maskedBlending == o.maskedBlending
+                   && textureWindow == o.textureWindow;
+        }
+        bool operator!=(const BatchState& o) const { return !(*this == o); }
+    };
+
+    const int bufferSize = 64 * 1024;  // vertices
 
     std::unique_ptr<Program> renderShader;
     std::unique_ptr<Program> blitShader;
@@ -42,10 +71,24 @@ class OpenGL {
     GLuint blitVao = 0;
     GLuint blitVbo = 0;
 
+    // In hardware rendering renderTex is the VRAM drawn to, vramTex its copy sampled as texture (updated after each batch)
     GLuint vramTex = 0;
     GLuint renderTex = 0;
     GLuint framebuffer = 0;
 
+    std::vector<Vertex> batch;
+    BatchState batchState = {};
+    VramDirtyMap batchWritten;
+
+    // VRAM upload ring, buffer is reused only after driver finished reading it
+    static const int UPLOAD_BUFFERS = 3;
+    GLuint uploadPbo[UPLOAD_BUFFERS] = {};
+    GLsync uploadFence[UPLOAD_BUFFERS] = {};
+    int uploadIndex = 0;
+
+    // Linear copy of VRAM area for transfers which don't go through upload ring
+    std::vector<uint16_t> staging;
+
     bool viewFullVram = false;
 
     bool loadExtensions();
@@ -54,7 +97,14 @@ class OpenGL {
     void createBlitBuffer();
     void createVramTexture();
     void createRenderTexture();
+    void createUploadBuffers();
+    void uploadVram(GPU* gpu);
     std::vector<BlitStruct> makeBlitBuf(int screenX = 0, int screenY = 0, int screenW = 640, int screenH = 480);
-    void renderFirstStage(const std::vector<Vertex>& renderList, GPU* gpu);
+    void addToBatch(GPU* gpu, const Vertex* v, int count);
+    void copyToVramTexture(const VramDirtyMap& area);
+    void setBlending(int transparency);
+    void drawBatch(int blendPass);
+    void renderFirstStage();
     void renderSecondStage();
+    void present(int displayAreaStartX, int displayAreaStartY, GP1_08 mode);
 };
\ No newline at end of file
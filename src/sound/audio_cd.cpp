@@ -1,38 +1,32 @@
 #include "audio_cd.h"
 #include <SDL.h>
 #include <SDL_audio.h>
-
-using namespace utils;
-
-Position AudioCD::currentPosition;
+#include <cstdio>
+#include <cstring>
 
 namespace {
 SDL_AudioDeviceID dev = 0;
-Cue currentCue;
+std::shared_ptr<AudioStream> currentStream;
 
+// Runs on SDL audio thread with device locked, only consumes what emulation has produced
 void audioCallback(void* userdata, Uint8* raw_stream, int len) {
-    auto bytes = currentCue.read(AudioCD::currentPosition, len, true);
-    AudioCD::currentPosition = AudioCD::currentPosition + Position(0, 0, 4);
-    uint8_t* samples = (uint8_t*)bytes.data();
+    int16_t* samples = (int16_t*)raw_stream;
+    size_t count = len / sizeof(int16_t);
 
-    for (int i = 0; i < len; i++) {
-        raw_stream[i] = 0;
+    if (currentStream) {
+        currentStream->read(samples, count);
+    } else {
+        memset(raw_stream, 0, len);
     }
-
-    for (int i = 0; i < bytes.size(); i++) {
-        raw_stream[i] = samples[i];
-    }
-
-    return;
 }
 }  // namespace
 
 void AudioCD::init() {
     SDL_AudioSpec desired = {}, obtained;
-    desired.freq = 44100;
+    desired.freq = AudioStream::SAMPLE_RATE;
     desired.format = AUDIO_S16;
     desired.channels = 2;
-    desired.samples = Track::SECTOR_SIZE;
+    desired.samples = 2352;  // about 53 ms per callback
     desired.callback = audioCallback;
 
     dev = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
@@ -45,17 +39,15 @@ void AudioCD::init() {
     if (obtained.freq != desired.freq || obtained.format != desired.format || obtained.channels != desired.channels
         || obtained.samples != desired.samples) {
         printf("SDL_OpenAudio obtained audio spec is different from desired, audio might sound wrong.\n");
-        return;
     }
-}
-
-void AudioCD::play(Cue& cue, Position& position) {
-    currentCue = cue;
-    currentPosition = position;
 
     SDL_PauseAudioDevice(dev, false);
 }
 
-void AudioCD::stop() { SDL_PauseAudioDevice(dev, true); }
+void AudioCD::setStream(std::shared_ptr<AudioStream> stream) {
+    SDL_LockAudioDevice(dev);
+    currentStream = stream;
+    SDL_UnlockAudioDevice(dev);
+}
 
 void AudioCD::close() { SDL_CloseAudioDevice(dev); }
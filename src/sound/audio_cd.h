@@ -1,10 +1,10 @@
 #pragma once
-#include "utils/cue/cue.h"
+#include <memory>
+#include "audio_stream.h"
 
 namespace AudioCD {
-extern utils::Position currentPosition;
 void init();
-void play(utils::Cue& cue, utils::Position& position);
-void stop();
+// Output plays samples of given stream, nullptr plays silence
+void setStream(std::shared_ptr<AudioStream> stream);
 void close();
-};  // namespace AudioCD
\ No newline at end of file
+};  // namespace AudioCD
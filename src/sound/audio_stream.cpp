@@ -0,0 +1,73 @@
+#include "audio_stream.h"
+#include <algorithm>
+#include <cstring>
+
+const size_t AudioStream::CAPACITY;
+const size_t AudioStream::TARGET_FILL;
+const int AudioStream::MAX_RATIO_ADJUST;
+
+void AudioStream::push(const int16_t* samples, size_t count) {
+    // Consumer only frees space, so rounding it down to whole frames never splits a frame
+    size_t free = (CAPACITY - ring.size()) & ~(size_t)1;
+    size_t written = ring.push(samples, std::min(count, free));
+    if (written < count) overruns += count - written;
+}
+
+void AudioStream::read(int16_t* out, size_t count) {
+    size_t buffered = ring.size();
+
+    if (!playing) {
+        if (buffered < TARGET_FILL) {
+            memset(out, 0, count * sizeof(int16_t));
+            return;
+        }
+        playing = true;
+        phase = 0x10000;
+        averageFill = (double)buffered;
+        prev[0] = prev[1] = next[0] = next[1] = 0;
+    }
+
+    // Producer delivers in bursts (emulated frames, XA sectors), averaged level keeps pitch steady.
+    // Fuller than target - consume slightly faster, emptier - slower, full correction at 25% away from target.
+    averageFill += (buffered - averageFill) / 8;
+    double error = (averageFill - TARGET_FILL) / TARGET_FILL;
+    int adjust = std::min(std::max((int)(error * 4 * MAX_RATIO_ADJUST), -MAX_RATIO_ADJUST), MAX_RATIO_ADJUST);
+    uint32_t ratio = 0x10000 + adjust;
+    step.store(ratio, std::memory_order_relaxed);
+
+    for (size_t i = 0; i + 1 < count; i += 2) {
+        while (phase >= 0x10000) {
+            int16_t frame[2];
+            if (ring.pop(frame, 2) < 2) {
+                underruns++;
+                playing = false;
+                memset(out + i, 0, (count - i) * sizeof(int16_t));
+                return;
+            }
+            prev[0] = next[0];
+            prev[1] = next[1];
+            next[0] = frame[0];
+            next[1] = frame[1];
+            phase -= 0x10000;
+        }
+
+        for (int c = 0; c < 2; c++) {
+            out[i + c] = (int16_t)(prev[c] + (((next[c] - prev[c]) * (int64_t)phase) >> 16));
+        }
+        phase += ratio;
+    }
+}
+
+AudioStream::Stats AudioStream::getStats() const {
+    Stats stats;
+    stats.underruns = underruns;
+    stats.overruns = overruns;
+    stats.buffered = ring.size();
+    stats.ratio = step.load(std::memory_order_relaxed) / (double)0x10000;
+    return stats;
+}
+
+void AudioStream::resetStats() {
+    underruns = 0;
+    overruns = 0;
+}
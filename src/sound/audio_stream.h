@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "utils/ring_buffer.h"
+
+/**
+ * PCM passed from emulation thread (single producer) to audio output (single consumer), 44.1 kHz interleaved stereo.
+ * Neither side blocks: producer drops samples that don't fit (overrun), consumer plays silence when buffer runs dry (underrun).
+ * Real time consumer uses read(), which slightly resamples to keep buffer around TARGET_FILL,
+ * so drift between emulated and audio device clocks is absorbed instead of ending in periodic underruns or overruns.
+ */
+class AudioStream {
+   public:
+    static const int SAMPLE_RATE = 44100;
+    static const size_t CAPACITY = 1 << 15;                  // int16 values, about 370 ms
+    static const size_t TARGET_FILL = CAPACITY * 3 / 8;      // about 140 ms of latency
+    static const int MAX_RATIO_ADJUST = 0x10000 * 5 / 1000;  // +-0.5% in 16.16, pitch change is not audible
+
+    struct Stats {
+        uint64_t underruns;  // output ran dry while playing (pausing emulation counts as one)
+        uint64_t overruns;   // int16 values dropped because buffer was full
+        size_t buffered;     // int16 values waiting for output
+        double ratio;        // input samples consumed per output sample
+    };
+
+    // Producer side, only whole stereo frames are queued
+    void push(const int16_t* samples, size_t count);
+
+    // Consumer side, playback in real time. Always fills count (even) values, missing ones with silence.
+    void read(int16_t* out, size_t count);
+    // Consumer side, samples as produced (recording), returns number of values read
+    size_t pop(int16_t* out, size_t count) { return ring.pop(out, count); }
+
+    Stats getStats() const;
+    void resetStats();
+
+   private:
+    utils::RingBuffer<int16_t, CAPACITY> ring;
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<uint64_t> overruns{0};
+    std::atomic<uint32_t> step{0x10000};  // Resampling ratio in 16.16, written by consumer
+
+    // Owned by consumer
+    bool playing = false;   // false while (re)filling buffer up to TARGET_FILL
+    uint32_t phase = 0;     // 16.16 position between prev and next frame
+    double averageFill = TARGET_FILL;
+    int16_t prev[2] = {};
+    int16_t next[2] = {};
+};
@@ -0,0 +1,151 @@
+#include "xa_adpcm.h"
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+const int BLOCK_SAMPLES = 28;
+const int GROUPS = 18;
+const int GROUP_SIZE = 128;
+const int DATA_OFFSET = 24;
+
+const int filterPos[4] = {0, 60, 115, 98};
+const int filterNeg[4] = {0, 0, -52, -55};
+
+inline int shiftOf(uint8_t header) {
+    int shift = header & 0x0f;
+    return shift > 12 ? 9 : shift;
+}
+
+// Nibble k of every 32 bit row is sample of block k, so one row holds 8 samples of 8 different blocks.
+// Sample is nibble << 12 >> shift, which is nibble * 2^(12 - shift) for shift <= 12.
+void unpack4(const uint8_t* group, int16_t raw[8][BLOCK_SAMPLES]) {
+    const uint8_t* data = group + 16;
+    int j = 0;
+#ifdef __SSE2__
+    alignas(16) int16_t factor[8];
+    for (int k = 0; k < 8; k++) factor[k] = (int16_t)(1 << (12 - shiftOf(group[4 + k])));
+    const __m128i scale = _mm_load_si128((const __m128i*)factor);
+    const __m128i lowNibbles = _mm_set1_epi16(0x0f);
+
+    for (; j < BLOCK_SAMPLES; j++) {
+        // Bytes of row to 16 bit lanes, then low nibble (even block) and high nibble (odd block) interleaved
+        uint32_t row32;
+        memcpy(&row32, data + j * 4, sizeof(row32));
+        __m128i bytes = _mm_unpacklo_epi8(_mm_cvtsi32_si128(row32), _mm_setzero_si128());
+        __m128i lo = _mm_and_si128(bytes, lowNibbles);
+        __m128i hi = _mm_srli_epi16(bytes, 4);
+        __m128i nibbles = _mm_unpacklo_epi16(lo, hi);
+        // Sign extend 4 bit values and scale by per block shift
+        __m128i samples = _mm_mullo_epi16(_mm_srai_epi16(_mm_slli_epi16(nibbles, 12), 12), scale);
+
+        alignas(16) int16_t row[8];
+        _mm_store_si128((__m128i*)row, samples);
+        for (int k = 0; k < 8; k++) raw[k][j] = row[k];
+    }
+#endif
+    for (; j < BLOCK_SAMPLES; j++) {
+        for (int k = 0; k < 8; k++) {
+            int nibble = (data[j * 4 + k / 2] >> ((k & 1) * 4)) & 0x0f;
+            raw[k][j] = (int16_t)(nibble << 12) >> shiftOf(group[4 + k]);
+        }
+    }
+}
+}  // namespace
+
+void XaDecoder::reset() {
+    for (auto& p : prev) p[0] = p[1] = 0;
+    for (auto& c : pcm) c[0] = 0;
+    phase = 0;
+}
+
+void XaDecoder::filterBlock(const int16_t* raw, int filter, int channel, int16_t* out) {
+    int32_t old = prev[channel][0];
+    int32_t older = prev[channel][1];
+    const int pos = filterPos[filter];
+    const int neg = filterNeg[filter];
+
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        int32_t s = raw[i] + ((old * pos + older * neg + 32) >> 6);
+        s = std::min(std::max(s, -0x8000), 0x7fff);
+        out[i] = (int16_t)s;
+        older = old;
+        old = s;
+    }
+
+    prev[channel][0] = old;
+    prev[channel][1] = older;
+}
+
+int XaDecoder::decodeGroup4(const uint8_t* group, bool stereo, int16_t* left, int16_t* right) {
+    int16_t raw[8][BLOCK_SAMPLES];
+    unpack4(group, raw);
+
+    int written = 0;
+    for (int k = 0; k < 8; k++) {
+        int filter = (group[4 + k] >> 4) & 3;
+        if (stereo) {
+            // Blocks alternate between left and right channel
+            filterBlock(raw[k], filter, k & 1, (k & 1 ? right : left) + (k / 2) * BLOCK_SAMPLES);
+        } else {
+            filterBlock(raw[k], filter, 0, left + k * BLOCK_SAMPLES);
+        }
+        written += BLOCK_SAMPLES;
+    }
+    return stereo ? written / 2 : written;
+}
+
+int XaDecoder::decodeGroup8(const uint8_t* group, bool stereo, int16_t* left, int16_t* right) {
+    const uint8_t* data = group + 16;
+
+    int written = 0;
+    for (int k = 0; k < 4; k++) {
+        int16_t raw[BLOCK_SAMPLES];
+        int shift = shiftOf(group[4 + k]);
+        int filter = (group[4 + k] >> 4) & 3;
+        for (int j = 0; j < BLOCK_SAMPLES; j++) raw[j] = (int16_t)(data[j * 4 + k] << 8) >> shift;
+
+        if (stereo) {
+            filterBlock(raw, filter, k & 1, (k & 1 ? right : left) + (k / 2) * BLOCK_SAMPLES);
+        } else {
+            filterBlock(raw, filter, 0, left + k * BLOCK_SAMPLES);
+        }
+        written += BLOCK_SAMPLES;
+    }
+    return stereo ? written / 2 : written;
+}
+
+size_t XaDecoder::decode(const uint8_t* sector, int16_t* out) {
+    SubHeader header = subHeader(sector);
+    const bool stereo = header.stereo();
+    const bool bit8 = header.bit8();
+
+    // Samples per channel of this sector, stored after interpolation history in pcm[c][0]
+    int count = 0;
+    for (int g = 0; g < GROUPS; g++) {
+        const uint8_t* group = sector + DATA_OFFSET + g * GROUP_SIZE;
+        int16_t* left = &pcm[0][1 + count];
+        int16_t* right = &pcm[1][1 + count];
+        count += bit8 ? decodeGroup8(group, stereo, left, right) : decodeGroup4(group, stereo, left, right);
+    }
+    if (!stereo) std::copy(&pcm[0][1], &pcm[0][1 + count], &pcm[1][1]);
+
+    // Linear interpolation to output rate
+    const uint32_t step = (uint32_t)(((uint64_t)header.sampleRate() << 16) / OUTPUT_RATE);
+    size_t written = 0;
+    for (; (int)(phase >> 16) < count; phase += step) {
+        int i = phase >> 16;
+        int frac = phase & 0xffff;
+        for (int c = 0; c < 2; c++) {
+            int a = pcm[c][i];
+            int b = pcm[c][i + 1];
+            out[written++] = (int16_t)(a + (int)(((int64_t)(b - a) * frac) >> 16));
+        }
+    }
+    phase -= count << 16;
+    pcm[0][0] = pcm[0][count];
+    pcm[1][0] = pcm[1][count];
+    return written;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * XA-ADPCM decoder for Mode 2 Form 2 audio sectors (4 and 8 bit, mono and stereo, 37.8 and 18.9 kHz).
+ * Output is resampled to 44.1 kHz interleaved stereo. Decoder state is kept between sectors of one stream,
+ * no memory is allocated after construction.
+ */
+class XaDecoder {
+   public:
+    static const int OUTPUT_RATE = 44100;
+    static const int SAMPLES_PER_SECTOR = 18 * 8 * 28;  // 18 sound groups, 8 blocks of 28 samples (4 bit mono)
+    // Worst case output of one sector: 18.9 kHz mono upsampled to 44.1 kHz stereo
+    static const int MAX_OUTPUT = (SAMPLES_PER_SECTOR * OUTPUT_RATE / 18900 + 2) * 2;
+
+    enum SubMode : uint8_t { EndOfRecord = 1 << 0, Video = 1 << 1, Audio = 1 << 2, Data = 1 << 3, RealTime = 1 << 6, EndOfFile = 1 << 7 };
+
+    struct SubHeader {
+        uint8_t file;
+        uint8_t channel;
+        uint8_t submode;
+        uint8_t codingInfo;
+
+        bool stereo() const { return (codingInfo & 3) == 1; }
+        int sampleRate() const { return ((codingInfo >> 2) & 3) == 1 ? 18900 : 37800; }
+        bool bit8() const { return ((codingInfo >> 4) & 3) == 1; }
+    };
+
+    // Raw 2352 byte sector
+    static SubHeader subHeader(const uint8_t* sector) { return {sector[16], sector[17], sector[18], sector[19]}; }
+    static bool isAudio(const uint8_t* sector) { return sector[15] == 2 && (sector[18] & SubMode::Audio); }
+
+    // Decodes raw 2352 byte audio sector, returns number of int16 values (2 per stereo frame) written to out (MAX_OUTPUT)
+    size_t decode(const uint8_t* sector, int16_t* out);
+    // Call when new stream starts (seek)
+    void reset();
+
+   private:
+    // ADPCM filter history per channel
+    int32_t prev[2][2] = {};
+    // Decoded samples of current sector per channel, index 0 holds last sample of previous sector for interpolation
+    int16_t pcm[2][SAMPLES_PER_SECTOR + 1] = {};
+    uint32_t phase = 0;  // 16.16 position between pcm[c][0] and pcm[c][1]
+
+    int decodeGroup4(const uint8_t* group, bool stereo, int16_t* left, int16_t* right);
+    int decodeGroup8(const uint8_t* group, bool stereo, int16_t* left, int16_t* right);
+    void filterBlock(const int16_t* raw, int filter, int channel, int16_t* out);
+};
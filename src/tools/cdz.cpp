@@ -0,0 +1,63 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "utils/cue/compressedImage.h"
+#include "utils/cue/cueParser.h"
+#include "utils/cue/discImage.h"
+#include "utils/file.h"
+
+// Converts .cue/.bin/.iso disc image to compressed .cdz image and verifies the result
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("usage: %s input.cue|input.bin|input.iso output.cdz\n", argv[0]);
+        return 1;
+    }
+    std::string input = argv[1];
+    std::string output = argv[2];
+
+    std::unique_ptr<utils::Cue> cue = nullptr;
+    std::string ext = getExtension(input);
+    if (ext == "cue") {
+        try {
+            utils::CueParser parser;
+            cue = parser.parse(input.c_str());
+        } catch (std::exception& e) {
+            printf("Error parsing cue: %s\n", e.what());
+        }
+    } else {
+        cue = utils::Cue::fromBin(input.c_str());
+    }
+    if (cue == nullptr) {
+        printf("Cannot load %s\n", input.c_str());
+        return 1;
+    }
+
+    utils::DiscImage source;
+    if (!source.load(*cue)) return 1;
+    if (!utils::CompressedImage::convert(source, output)) return 1;
+
+    auto compressedCue = utils::Cue::fromCdz(output.c_str());
+    utils::DiscImage result;
+    if (compressedCue == nullptr || !result.load(*compressedCue)) {
+        printf("Cannot open %s\n", output.c_str());
+        return 1;
+    }
+
+    uint8_t a[utils::Track::SECTOR_SIZE], b[utils::Track::SECTOR_SIZE];
+    size_t inputSize = 0;
+    for (int lba = 0; lba < source.getSectorCount(); lba++) {
+        const uint8_t* expected = source.sector(lba, a);
+        if (expected == nullptr) continue;
+        inputSize += utils::Track::SECTOR_SIZE;
+
+        const uint8_t* actual = result.sector(lba, b);
+        if (actual == nullptr || memcmp(expected, actual, utils::Track::SECTOR_SIZE) != 0) {
+            printf("Verification failed at sector %d\n", lba);
+            return 1;
+        }
+    }
+
+    size_t outputSize = getFileSize(output);
+    printf("%s: %zu -> %zu bytes (%.1f%%)\n", output.c_str(), inputSize, outputSize, inputSize ? 100.0 * outputSize / inputSize : 0.0);
+    return 0;
+}
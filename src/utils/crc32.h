@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+// CRC-32 (IEEE 802.3, same as zlib), pass previous result to continue calculation
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+}  // namespace utils
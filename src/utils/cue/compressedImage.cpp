@@ -0,0 +1,303 @@
+#include "compressedImage.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "discImage.h"
+#include "utils/crc32.h"
+#include "utils/lz.h"
+
+namespace utils {
+namespace {
+const char MAGIC[4] = {'C', 'D', 'Z', 0x1a};
+const uint32_t VERSION = 1;
+const int SECTOR_SIZE = Track::SECTOR_SIZE;
+
+static_assert(sizeof(CompressedImage::Header) == 24, "Unexpected Header padding");
+static_assert(sizeof(CompressedImage::TrackEntry) == 32, "Unexpected TrackEntry padding");
+static_assert(sizeof(CompressedImage::HunkEntry) == 24, "Unexpected HunkEntry padding");
+
+// Audio samples change slowly, differences of neighbouring samples of one channel compress far better than samples itself.
+// High bytes of differences are mostly 0x00 or 0xff, so bytes are split into two planes.
+void deltaEncode(const uint8_t* src, uint8_t* dst, size_t size) {
+    const size_t count = size / 2;
+    int16_t previous[2] = {0, 0};
+    for (size_t i = 0; i < count; i++) {
+        int16_t sample;
+        memcpy(&sample, src + i * 2, sizeof(sample));
+        uint16_t delta = (uint16_t)(sample - previous[i & 1]);
+        previous[i & 1] = sample;
+
+        dst[i] = (uint8_t)delta;
+        dst[count + i] = (uint8_t)(delta >> 8);
+    }
+}
+
+void deltaDecode(const uint8_t* src, uint8_t* dst, size_t size) {
+    const size_t count = size / 2;
+    int16_t previous[2] = {0, 0};
+    for (size_t i = 0; i < count; i++) {
+        uint16_t delta = src[i] | src[count + i] << 8;
+        int16_t sample = (int16_t)(previous[i & 1] + delta);
+        previous[i & 1] = sample;
+
+        memcpy(dst + i * 2, &sample, sizeof(sample));
+    }
+}
+}  // namespace
+
+bool CompressedImage::open(const std::string& path) {
+    this->path = path;
+    tracks.clear();
+    hunks = nullptr;
+
+    if (!file.open(path)) return false;
+
+    const uint8_t* data = file.getData();
+    if (file.getSize() < sizeof(Header)) return false;
+    memcpy(&header, data, sizeof(Header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+        printf("%s is not a CDZ image\n", path.c_str());
+        return false;
+    }
+
+    const size_t tracksOffset = sizeof(Header);
+    const size_t hunksOffset = tracksOffset + (size_t)header.trackCount * sizeof(TrackEntry);
+    const size_t dataOffset = hunksOffset + (size_t)header.hunkCount * sizeof(HunkEntry);
+    if (header.hunkSectors == 0 || dataOffset > file.getSize()
+        || header.hunkCount != (header.sectorCount + header.hunkSectors - 1) / header.hunkSectors) {
+        printf("%s is corrupted\n", path.c_str());
+        return false;
+    }
+
+    tracks.resize(header.trackCount);
+    memcpy(tracks.data(), data + tracksOffset, tracks.size() * sizeof(TrackEntry));
+    hunks = (const HunkEntry*)(data + hunksOffset);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.clear();
+    cache.resize(CACHED_HUNKS);
+    useCounter = 0;
+    return true;
+}
+
+std::unique_ptr<Cue> CompressedImage::getCue() const {
+    auto cue = std::make_unique<Cue>();
+    cue->file = path;
+
+    for (auto& e : tracks) {
+        Track t;
+        t.filename = path;
+        t.number = e.number;
+        t.type = (Track::Type)e.type;
+        t.pregap = Position::fromLba(e.pregap);
+        t.pause = Position::fromLba(e.pause);
+        t.start = Position::fromLba(e.start);
+        t.end = Position::fromLba(e.end);
+        t.offsetInFile = e.offsetInFile;
+        t.size = getSize();
+        cue->tracks.push_back(t);
+    }
+    return cue;
+}
+
+size_t CompressedImage::hunkSize(int hunk) const {
+    size_t first = (size_t)hunk * header.hunkSectors;
+    return std::min<size_t>(header.hunkSectors, header.sectorCount - first) * SECTOR_SIZE;
+}
+
+bool CompressedImage::decompressHunk(int hunk, std::vector<uint8_t>& out) const {
+    const HunkEntry& entry = hunks[hunk];
+    const size_t size = hunkSize(hunk);
+    out.resize(size);
+
+    bool valid = entry.offset <= file.getSize() && entry.size <= file.getSize() - entry.offset;
+    if (valid) {
+        const uint8_t* src = file.getData() + entry.offset;
+        if (entry.codec == Codec::Stored) {
+            valid = entry.size == size;
+            if (valid) memcpy(out.data(), src, size);
+        } else if (entry.codec == Codec::Lz) {
+            valid = lz::decompress(src, entry.size, out.data(), size);
+        } else if (entry.codec == Codec::LzAudioDelta) {
+            std::vector<uint8_t> planes(size);
+            valid = lz::decompress(src, entry.size, planes.data(), size);
+            if (valid) deltaDecode(planes.data(), out.data(), size);
+        } else {
+            valid = false;
+        }
+    }
+
+    if (!valid || crc32(out.data(), size) != entry.crc) {
+        printf("%s: hunk %d is corrupted\n", path.c_str(), hunk);
+        return false;
+    }
+    return true;
+}
+
+CompressedImage::CachedHunk* CompressedImage::findHunk(int hunk) {
+    for (auto& c : cache) {
+        if (c.index == hunk) {
+            c.lastUse = ++useCounter;
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+void CompressedImage::storeHunk(int hunk, std::vector<uint8_t>& data) {
+    // Other thread might have decompressed it in the meantime
+    if (findHunk(hunk)) return;
+
+    auto lru = std::min_element(cache.begin(), cache.end(), [](const CachedHunk& a, const CachedHunk& b) { return a.lastUse < b.lastUse; });
+    lru->index = hunk;
+    lru->lastUse = ++useCounter;
+    lru->data.swap(data);
+}
+
+bool CompressedImage::readSector(int sector, uint8_t* out) {
+    if (sector < 0 || (uint32_t)sector >= header.sectorCount) return false;
+    const int hunk = sector / header.hunkSectors;
+    const size_t offset = (size_t)(sector % header.hunkSectors) * SECTOR_SIZE;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (CachedHunk* cached = findHunk(hunk)) {
+            memcpy(out, cached->data.data() + offset, SECTOR_SIZE);
+            return true;
+        }
+    }
+
+    // Decompression runs unlocked, other readers are not blocked by slow storage
+    std::vector<uint8_t> data;
+    if (!decompressHunk(hunk, data)) return false;
+    memcpy(out, data.data() + offset, SECTOR_SIZE);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    storeHunk(hunk, data);
+    return true;
+}
+
+void CompressedImage::prefetchSector(int sector) {
+    if (sector < 0 || (uint32_t)sector >= header.sectorCount) return;
+    const int hunk = sector / header.hunkSectors;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (findHunk(hunk)) return;
+    }
+
+    std::vector<uint8_t> data;
+    if (!decompressHunk(hunk, data)) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    storeHunk(hunk, data);
+}
+
+bool CompressedImage::convert(const DiscImage& disc, const std::string& path) {
+    const Cue& cue = disc.getCue();
+
+    // Stream holds sectors of every track including its pause, sectors missing from source are zeroed
+    std::vector<TrackEntry> trackEntries;
+    std::vector<int> streamLba;
+    std::vector<bool> audio;
+    for (auto& t : cue.tracks) {
+        int first = std::max((t.start - t.pause).toLba(), 0);
+        int end = std::max(t.end.toLba(), first);
+
+        TrackEntry e = {};
+        e.number = t.number;
+        e.type = (uint32_t)t.type;
+        e.pregap = t.pregap.toLba();
+        e.pause = t.pause.toLba();
+        e.start = t.start.toLba();
+        e.end = t.end.toLba();
+        e.offsetInFile = (uint64_t)(streamLba.size() + (t.start.toLba() - first)) * SECTOR_SIZE;
+        trackEntries.push_back(e);
+
+        for (int lba = first; lba < end; lba++) {
+            streamLba.push_back(lba);
+            audio.push_back(t.type == Track::Type::AUDIO);
+        }
+    }
+
+    Header h = {};
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.hunkSectors = HUNK_SECTORS;
+    h.sectorCount = streamLba.size();
+    h.hunkCount = (h.sectorCount + HUNK_SECTORS - 1) / HUNK_SECTORS;
+    h.trackCount = trackEntries.size();
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        printf("Cannot open %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<HunkEntry> hunkEntries(h.hunkCount);
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(trackEntries.data(), sizeof(TrackEntry), trackEntries.size(), f);
+    fwrite(hunkEntries.data(), sizeof(HunkEntry), hunkEntries.size(), f);  // Filled in at the end
+    uint64_t offset = sizeof(h) + trackEntries.size() * sizeof(TrackEntry) + hunkEntries.size() * sizeof(HunkEntry);
+
+    std::vector<uint8_t> raw(HUNK_SECTORS * SECTOR_SIZE);
+    std::vector<uint8_t> planes(raw.size());
+    std::vector<uint8_t> compressed(lz::bound(raw.size()));
+    std::vector<uint8_t> candidate(compressed.size());
+
+    for (uint32_t hunk = 0; hunk < h.hunkCount; hunk++) {
+        const size_t first = (size_t)hunk * HUNK_SECTORS;
+        const size_t sectors = std::min<size_t>(HUNK_SECTORS, h.sectorCount - first);
+        const size_t size = sectors * SECTOR_SIZE;
+
+        bool hasAudio = false;
+        for (size_t i = 0; i < sectors; i++) {
+            const uint8_t* s = disc.sector(streamLba[first + i], raw.data() + i * SECTOR_SIZE);
+            if (s == nullptr) {
+                memset(raw.data() + i * SECTOR_SIZE, 0, SECTOR_SIZE);
+            } else if (s != raw.data() + i * SECTOR_SIZE) {
+                memcpy(raw.data() + i * SECTOR_SIZE, s, SECTOR_SIZE);
+            }
+            hasAudio |= audio[first + i];
+        }
+
+        // Smallest of stored, plain and (for audio) delta filtered
+        HunkEntry& e = hunkEntries[hunk];
+        e.crc = crc32(raw.data(), size);
+        e.codec = Codec::Stored;
+        e.size = size;
+        const uint8_t* payload = raw.data();
+
+        size_t lzSize = lz::compress(raw.data(), size, compressed.data(), compressed.size());
+        if (lzSize != 0 && lzSize < e.size) {
+            e.codec = Codec::Lz;
+            e.size = lzSize;
+            payload = compressed.data();
+        }
+
+        if (hasAudio) {
+            deltaEncode(raw.data(), planes.data(), size);
+            size_t deltaSize = lz::compress(planes.data(), size, candidate.data(), candidate.size());
+            if (deltaSize != 0 && deltaSize < e.size) {
+                e.codec = Codec::LzAudioDelta;
+                e.size = deltaSize;
+                payload = candidate.data();
+            }
+        }
+
+        e.offset = offset;
+        if (fwrite(payload, 1, e.size, f) != e.size) {
+            printf("Cannot write %s\n", path.c_str());
+            fclose(f);
+            return false;
+        }
+        offset += e.size;
+    }
+
+    fseek(f, sizeof(h) + trackEntries.size() * sizeof(TrackEntry), SEEK_SET);
+    fwrite(hunkEntries.data(), sizeof(HunkEntry), hunkEntries.size(), f);
+    bool success = !ferror(f);
+    fclose(f);
+    return success;
+}
+}  // namespace utils
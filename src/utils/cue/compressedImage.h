@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cue.h"
+#include "utils/mapped_file.h"
+
+namespace utils {
+class DiscImage;
+
+/**
+ * Compressed disc image (.cdz).
+ * Sectors of all tracks are stored as one stream split into hunks of HUNK_SECTORS sectors,
+ * each compressed separately, so any sector can be reached through fixed size hunk index.
+ *
+ * Layout (little endian):
+ *   Header
+ *   TrackEntry[trackCount]  - track list, offsetInFile is byte offset in uncompressed stream
+ *   HunkEntry[hunkCount]    - file offset, size, CRC32 of uncompressed data and codec of every hunk
+ *   hunk data
+ *
+ * Decompressed hunks are kept in small LRU cache, readSector is thread safe.
+ */
+class CompressedImage {
+   public:
+    static const int HUNK_SECTORS = 8;
+    static const int CACHED_HUNKS = 64;  // Covers read-ahead window of DiscImage
+
+    enum class Codec : uint32_t {
+        Stored = 0,
+        Lz = 1,
+        LzAudioDelta = 2,  // 16 bit stereo samples delta coded per channel, split to low/high byte planes
+    };
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t hunkSectors;
+        uint32_t sectorCount;
+        uint32_t hunkCount;
+        uint32_t trackCount;
+    };
+
+    struct TrackEntry {
+        uint32_t number;
+        uint32_t type;  // Track::Type
+        uint32_t pregap;
+        uint32_t pause;
+        uint32_t start;
+        uint32_t end;
+        uint64_t offsetInFile;
+    };
+
+    struct HunkEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t crc;
+        Codec codec;
+        uint32_t reserved;
+    };
+
+    bool open(const std::string& path);
+
+    // Cue with all tracks pointing to this image
+    std::unique_ptr<Cue> getCue() const;
+    // Size of uncompressed sector stream
+    size_t getSize() const { return (size_t)header.sectorCount * Track::SECTOR_SIZE; }
+
+    // Sector of uncompressed stream, false if it is past the end or its hunk is corrupted
+    bool readSector(int sector, uint8_t* out);
+    // Decompresses hunk of given sector into cache ahead of use
+    void prefetchSector(int sector);
+
+    // Writes sectors of all tracks of loaded disc, returns false on I/O error
+    static bool convert(const DiscImage& disc, const std::string& path);
+
+   private:
+    struct CachedHunk {
+        int index = -1;
+        uint64_t lastUse = 0;
+        std::vector<uint8_t> data;
+    };
+
+    std::string path;
+    MappedFile file;
+    Header header = {};
+    std::vector<TrackEntry> tracks;
+    const HunkEntry* hunks = nullptr;
+
+    std::mutex mutex;
+    std::vector<CachedHunk> cache;
+    uint64_t useCounter = 0;
+
+    bool decompressHunk(int hunk, std::vector<uint8_t>& out) const;
+    size_t hunkSize(int hunk) const;
+    // Returns cached hunk and marks it as recently used, mutex must be held
+    CachedHunk* findHunk(int hunk);
+    void storeHunk(int hunk, std::vector<uint8_t>& data);
+};
+}  // namespace utils
@@ -1,7 +1,6 @@
 #pragma once
 #include <cstdio>
 #include <memory>
-#include <unordered_map>
 #include <vector>
 #include "position.h"
 #include "track.h"
@@ -17,12 +16,8 @@ struct Cue {
     Position getTrackLength(int track) const;
 
     void seekTo();
-    std::vector<uint8_t> read(Position& pos, size_t bytes, bool audio = false);
-    // read method
 
     static std::unique_ptr<Cue> fromBin(const char* file);
-
-   private:
-    std::unordered_map<std::string, std::shared_ptr<FILE>> files;
+    static std::unique_ptr<Cue> fromCdz(const char* file);
 };
 }  // namespace utils
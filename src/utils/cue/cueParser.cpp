@@ -86,34 +86,39 @@ void CueParser::fixTracksLength() {
         Track& track = cue.tracks[0];
 
         track.offsetInFile = 0;
-        track.end = Position::fromLba(track.size / Track::SECTOR_SIZE);
+        track.end = globalOffset + Position::fromLba(track.size / Track::SECTOR_SIZE);
         return;
     }
 
-    Position lastEnd = globalOffset;
+    // Disc position of first sector stored in current file
+    Position fileStart = globalOffset;
 
     for (int i = 0; i < cue.getTrackCount(); i++) {
         Track& t = cue.tracks[i];
         // last track
         // fix length for last track
         if (i == cue.getTrackCount() - 1) {
-            t.end = lastEnd + Position::fromLba(t.size / Track::SECTOR_SIZE);
+            t.end = fileStart + Position::fromLba(t.size / Track::SECTOR_SIZE);
 
             break;
         }
 
         Track& n = cue.tracks[i + 1];
 
+        // Indexes are relative to beginning of their file, rebase them onto the disc
+        Position index1 = n.start - globalOffset - n.pregap;
+
         if (t.filename == n.filename) {
+            n.start = fileStart + index1 + n.pregap;
             t.end = n.start - (n.pregap + n.pause) + t.pregap;
-            n.offsetInFile = t.end.toLba() * Track::SECTOR_SIZE;
         } else {
-            t.offsetInFile = 0;
-            t.end = Position::fromLba(t.size / Track::SECTOR_SIZE) + lastEnd;
-            n.start = n.start + t.end;
+            t.end = Position::fromLba(t.size / Track::SECTOR_SIZE) + fileStart;
 
-            lastEnd = t.end;
+            // Next file follows this track
+            fileStart = t.end + n.pregap;
+            n.start = fileStart + index1;
         }
+        n.offsetInFile = index1.toLba() * Track::SECTOR_SIZE;
 
         //        Track& prev = cue.tracks[i - 1];
         //        Track& next = cue.tracks[i];
@@ -0,0 +1,171 @@
+#include "discImage.h"
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+#include "utils/file.h"
+
+namespace {
+const size_t PAGE_SIZE = 4096;
+
+inline uint64_t packRange(int begin, int end) { return (uint64_t)(uint32_t)begin << 32 | (uint32_t)end; }
+inline int rangeBegin(uint64_t range) { return (int)(range >> 32); }
+inline int rangeEnd(uint64_t range) { return (int)(uint32_t)range; }
+}  // namespace
+
+namespace utils {
+const uint8_t DiscImage::NO_SPAN;
+
+DiscImage::~DiscImage() { stopPrefetch(); }
+
+bool DiscImage::load(const Cue& cue) {
+    stopPrefetch();
+
+    this->cue = cue;
+    files.clear();
+    compressed = nullptr;
+    spans.clear();
+    spanOfSector.clear();
+
+    // Tracks sharing one bin file share its mapping
+    std::unordered_map<std::string, std::shared_ptr<MappedFile>> mapped;
+
+    for (int i = 0; i < cue.getTrackCount(); i++) {
+        const Track& track = cue.tracks[i];
+
+        size_t fileSize;
+        const uint8_t* fileData = nullptr;
+        if (getExtension(track.filename) == "cdz") {
+            // All tracks of compressed image share single stream
+            if (!compressed) {
+                compressed = std::make_shared<CompressedImage>();
+                if (!compressed->open(track.filename)) {
+                    printf("Unable to open file %s\n", track.filename.c_str());
+                    return false;
+                }
+            }
+            fileSize = compressed->getSize();
+        } else {
+            auto it = mapped.find(track.filename);
+            if (it == mapped.end()) {
+                auto file = std::make_shared<MappedFile>();
+                if (!file->open(track.filename)) {
+                    printf("Unable to map file %s\n", track.filename.c_str());
+                    return false;
+                }
+                files.push_back(file);
+                it = mapped.emplace(track.filename, file).first;
+            }
+            fileSize = it->second->getSize();
+            fileData = it->second->getData();
+        }
+
+        // Pause is stored in image before track start, sector at start is located at offsetInFile
+        int startLba = track.start.toLba();
+        int firstLba = std::max((track.start - track.pause).toLba(), 0);
+        int64_t firstOffset = (int64_t)track.offsetInFile + (int64_t)(firstLba - startLba) * SECTOR_SIZE;
+        if (firstOffset < 0) {
+            firstLba += (int)((-firstOffset + SECTOR_SIZE - 1) / SECTOR_SIZE);
+            firstOffset = (int64_t)track.offsetInFile + (int64_t)(firstLba - startLba) * SECTOR_SIZE;
+        }
+
+        // Truncated images end with the file
+        int64_t sectorsInFile = firstOffset < (int64_t)fileSize ? (fileSize - firstOffset) / SECTOR_SIZE : 0;
+        int endLba = (int)std::min<int64_t>(track.end.toLba(), firstLba + sectorsInFile);
+        if (endLba <= firstLba) continue;
+
+        if (spans.size() >= NO_SPAN) {
+            printf("Too many tracks in %s\n", cue.file.c_str());
+            return false;
+        }
+
+        if ((int)spanOfSector.size() < endLba) spanOfSector.resize(endLba, NO_SPAN);
+        std::fill(spanOfSector.begin() + firstLba, spanOfSector.begin() + endLba, (uint8_t)spans.size());
+        spans.push_back({fileData ? fileData + firstOffset : nullptr, (size_t)firstOffset, firstLba, endLba, i});
+    }
+
+    // Disc is read from the beginning after insertion
+    prefetched = packRange(0, 0);
+    prefetchTarget = 0;
+    resetPrefetchStats();
+    quit = false;
+    prefetchThread = std::thread(&DiscImage::prefetchLoop, this);
+    return true;
+}
+
+const uint8_t* DiscImage::read(int lba, uint8_t* buffer) {
+    uint64_t range = prefetched.load(std::memory_order_acquire);
+    bool hit = lba >= rangeBegin(range) && lba < rangeEnd(range);
+    if (hit) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    prefetchTarget.store(lba + 1, std::memory_order_release);
+    // Wake prefetch thread only on miss (seek without prefetch()) or when read-ahead window is half used up
+    if (!hit || (rangeEnd(range) - lba < PREFETCH_SECTORS / 2 && rangeEnd(range) < getSectorCount())) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeUp.notify_one();
+    }
+
+    return sector(lba, buffer);
+}
+
+void DiscImage::prefetch(int lba) {
+    std::lock_guard<std::mutex> lock(mutex);
+    prefetchTarget.store(lba, std::memory_order_release);
+    wakeUp.notify_one();
+}
+
+void DiscImage::prefetchLoop() {
+    while (!quit) {
+        int target = prefetchTarget.load(std::memory_order_acquire);
+        uint64_t range = prefetched.load(std::memory_order_relaxed);
+        int begin = rangeBegin(range);
+        int end = rangeEnd(range);
+
+        // Seek outside of window restarts it, sequential reads slide it forward
+        if (target < begin || target > end) {
+            begin = end = target;
+        } else {
+            begin = target;
+        }
+
+        if (end < std::min(target + PREFETCH_SECTORS, getSectorCount())) {
+            prefetchSector(end);
+            prefetched.store(packRange(begin, end + 1), std::memory_order_release);
+            continue;
+        }
+
+        prefetched.store(packRange(begin, end), std::memory_order_release);
+
+        // Window is full, sleep until reader moves on (read() wakes this thread when half of it is used up) or seeks
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeUp.wait(lock, [&] { return quit || prefetchTarget.load(std::memory_order_acquire) != target; });
+    }
+}
+
+void DiscImage::prefetchSector(int lba) {
+    if (trackAt(lba) < 0) return;
+    const Span& span = spans[spanOfSector[lba]];
+
+    if (span.data) {
+        // Touch every page of sector, faults block this thread only
+        const volatile uint8_t* data = span.data + (size_t)(lba - span.firstLba) * SECTOR_SIZE;
+        for (size_t i = 0; i < SECTOR_SIZE; i += PAGE_SIZE) (void)data[i];
+        (void)data[SECTOR_SIZE - 1];
+    } else {
+        compressed->prefetchSector((int)(span.offset / SECTOR_SIZE) + (lba - span.firstLba));
+    }
+}
+
+void DiscImage::stopPrefetch() {
+    if (!prefetchThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        wakeUp.notify_one();
+    }
+    prefetchThread.join();
+}
+}  // namespace utils
@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "compressedImage.h"
+#include "cue.h"
+#include "utils/mapped_file.h"
+
+namespace utils {
+/**
+ * Sector storage of loaded disc, shared by CD-ROM controller, DMA3 and CD audio.
+ * Every track file is memory mapped once, sectors are returned as pointers into the mapping.
+ * Compressed (.cdz) images are decompressed hunk by hunk into caller provided buffer instead.
+ * Sectors are addressed by absolute LBA (00:02:00 is LBA 150), lookup is a single table index.
+ *
+ * Background thread faults in sectors ahead of last read (or seek) position, so slow storage
+ * stalls prefetch thread instead of emulation.
+ */
+class DiscImage {
+    struct Span {
+        const uint8_t* data;  // First sector of span, nullptr for compressed image
+        size_t offset;        // Byte offset of first sector in compressed stream
+        int firstLba;
+        int endLba;
+        int track;
+    };
+
+    static const uint8_t NO_SPAN = 0xff;
+
+    Cue cue;
+    std::vector<std::shared_ptr<MappedFile>> files;
+    std::shared_ptr<CompressedImage> compressed;
+    std::vector<Span> spans;
+    std::vector<uint8_t> spanOfSector;  // Index to spans for each LBA
+
+    // Prefetched sectors [begin, end) packed as begin << 32 | end, published by prefetch thread
+    std::atomic<uint64_t> prefetched{0};
+    std::atomic<int> prefetchTarget{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+    std::thread prefetchThread;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::atomic<bool> quit{false};
+
+    void prefetchLoop();
+    void prefetchSector(int lba);
+    void stopPrefetch();
+
+   public:
+    static const int SECTOR_SIZE = Track::SECTOR_SIZE;
+    static const int PREFETCH_SECTORS = 300;  // 2 seconds of double speed reading
+
+    struct PrefetchStats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    DiscImage() = default;
+    DiscImage(const DiscImage&) = delete;
+    DiscImage& operator=(const DiscImage&) = delete;
+    ~DiscImage();
+
+    // Maps all files referenced by cue, returns false if any of them cannot be mapped
+    bool load(const Cue& cue);
+
+    const Cue& getCue() const { return cue; }
+    int getSectorCount() const { return spanOfSector.size(); }
+
+    // Track index containing lba or -1 if sector is not stored in image (lead-in, pregaps, past the end)
+    int trackAt(int lba) const {
+        if (lba < 0 || lba >= getSectorCount() || spanOfSector[lba] == NO_SPAN) return -1;
+        return spans[spanOfSector[lba]].track;
+    }
+
+    // Raw 2352 byte sector or nullptr if sector is not stored in image.
+    // Points into mapped file, or to buffer (SECTOR_SIZE bytes) for compressed images.
+    const uint8_t* sector(int lba, uint8_t* buffer) const {
+        if (lba < 0 || lba >= getSectorCount() || spanOfSector[lba] == NO_SPAN) return nullptr;
+        const Span& span = spans[spanOfSector[lba]];
+        if (span.data) return span.data + (size_t)(lba - span.firstLba) * SECTOR_SIZE;
+
+        int streamSector = (int)(span.offset / SECTOR_SIZE) + (lba - span.firstLba);
+        return compressed->readSector(streamSector, buffer) ? buffer : nullptr;
+    }
+
+    // sector() for sequential readers, counts prefetch hits and keeps read-ahead going
+    const uint8_t* read(int lba, uint8_t* buffer);
+
+    // Restarts read-ahead at lba, call on seek before first read
+    void prefetch(int lba);
+
+    PrefetchStats getPrefetchStats() const { return {hits, misses}; }
+    void resetPrefetchStats() {
+        hits = 0;
+        misses = 0;
+    }
+};
+}  // namespace utils
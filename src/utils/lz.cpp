@@ -0,0 +1,127 @@
+#include "lz.h"
+#include <cstring>
+#include <vector>
+
+namespace lz {
+namespace {
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xffff;
+const int HASH_BITS = 12;
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - HASH_BITS); }
+
+// Length field continues in following bytes when nibble is saturated
+bool putLength(uint8_t*& op, const uint8_t* end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (op >= end) return false;
+        *op++ = 255;
+    }
+    if (op >= end) return false;
+    *op++ = (uint8_t)length;
+    return true;
+}
+
+bool getLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+bool putSequence(uint8_t*& op, const uint8_t* end, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+
+    if (op >= end) return false;
+    *op++ = (uint8_t)((literalLength < 15 ? literalLength : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+    if (literalLength >= 15 && !putLength(op, end, literalLength - 15)) return false;
+
+    if ((size_t)(end - op) < literalLength) return false;
+    memcpy(op, literals, literalLength);
+    op += literalLength;
+
+    if (matchLength == 0) return true;
+    if (end - op < 2) return false;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    if (matchCode >= 15 && !putLength(op, end, matchCode - 15)) return false;
+    return true;
+}
+}  // namespace
+
+size_t bound(size_t size) { return size + size / 255 + 16; }
+
+size_t compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity) {
+    std::vector<uint32_t> table(1 << HASH_BITS, 0);  // Position + 1 of last occurrence, 0 - none
+
+    uint8_t* op = dst;
+    const uint8_t* end = dst + dstCapacity;
+    size_t ip = 0;
+    size_t anchor = 0;
+
+    while (ip + MIN_MATCH <= srcSize) {
+        uint32_t v = read32(src + ip);
+        uint32_t& slot = table[hash(v)];
+        size_t ref = slot;
+        slot = (uint32_t)(ip + 1);
+
+        if (ref == 0 || ip - (ref - 1) > MAX_OFFSET || read32(src + ref - 1) != v) {
+            ip++;
+            continue;
+        }
+        ref--;
+
+        size_t length = MIN_MATCH;
+        while (ip + length < srcSize && src[ref + length] == src[ip + length]) length++;
+
+        if (!putSequence(op, end, src + anchor, ip - anchor, ip - ref, length)) return 0;
+        ip += length;
+        anchor = ip;
+    }
+
+    if (anchor < srcSize && !putSequence(op, end, src + anchor, srcSize - anchor, 0, 0)) return 0;
+    return op - dst;
+}
+
+bool decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + srcSize;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !getLength(ip, end, literalLength)) return false;
+        if ((size_t)(end - ip) < literalLength || dstSize - op < literalLength) return false;
+        memcpy(dst + op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        // Last sequence has literals only
+        if (ip == end) break;
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op) return false;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !getLength(ip, end, matchLength)) return false;
+        matchLength += MIN_MATCH;
+        if (dstSize - op < matchLength) return false;
+
+        // Source and destination may overlap (repeating pattern)
+        for (size_t i = 0; i < matchLength; i++, op++) dst[op] = dst[op - offset];
+    }
+    return op == dstSize;
+}
+}  // namespace lz
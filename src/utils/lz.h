@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// LZ77 block codec using LZ4 sequence layout (token, literals, 16 bit offset, extended lengths).
+// Meant for small blocks that are decompressed on demand, no framing or checksums.
+namespace lz {
+// Worst case compressed size of size bytes
+size_t bound(size_t size);
+// Returns compressed size or 0 if result does not fit into dstCapacity
+size_t compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+// Returns false if input is malformed or does not decompress to exactly dstSize bytes
+bool decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+}  // namespace lz
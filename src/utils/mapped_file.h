@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace utils {
+/**
+ * Read-only memory mapping of whole file.
+ * Pages are loaded by OS on first access and shared with page cache, no copy is made.
+ */
+class MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+
+   public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    void close();
+
+    const uint8_t* getData() const { return data; }
+    size_t getSize() const { return size; }
+};
+}  // namespace utils
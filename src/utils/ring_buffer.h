@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace utils {
+/**
+ * Lock-free single producer, single consumer ring buffer.
+ * push* may be called only from producer thread, pop* only from consumer thread.
+ * Size must be a power of 2.
+ */
+template <typename T, size_t Size>
+class RingBuffer {
+    static_assert((Size & (Size - 1)) == 0, "Size must be a power of 2");
+
+    std::vector<T> buffer;
+    alignas(64) std::atomic<size_t> head;  // next write, modified by producer
+    alignas(64) std::atomic<size_t> tail;  // next read, modified by consumer
+
+   public:
+    RingBuffer() : buffer(Size), head(0), tail(0) {}
+
+    bool push(const T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Size) return false;
+
+        buffer[h & (Size - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t) return false;
+
+        value = buffer[t & (Size - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns number of elements written
+    size_t push(const T* data, size_t count) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t free = Size - (h - tail.load(std::memory_order_acquire));
+        if (count > free) count = free;
+
+        for (size_t i = 0; i < count; i++) {
+            buffer[(h + i) & (Size - 1)] = data[i];
+        }
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // Returns number of elements read
+    size_t pop(T* data, size_t count) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t available = head.load(std::memory_order_acquire) - t;
+        if (count > available) count = available;
+
+        for (size_t i = 0; i < count; i++) {
+            data[i] = buffer[(t + i) & (Size - 1)];
+        }
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // Drops all elements pushed so far, moves tail so it must not run concurrently with pop
+    void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return Size; }
+};
+}  // namespace utils
@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+
+namespace utils {
+/**
+ * Lock-free triple buffer for single producer and single consumer.
+ * Producer fills back buffer and publishes it, consumer picks up the most recently published one.
+ * Neither side ever waits for the other, unconsumed buffers are overwritten.
+ */
+template <typename T>
+class TripleBuffer {
+    static const int FRESH = 4;  // middle buffer was published and not consumed yet
+
+    T buffers[3];
+    int back = 0;                // owned by producer
+    int front = 1;               // owned by consumer
+    std::atomic<int> middle{2};  // index | FRESH
+
+   public:
+    T& backBuffer() { return buffers[back]; }
+
+    void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3; }
+
+    // Returns true if a new buffer was published since last call
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+
+    const T& frontBuffer() const { return buffers[front]; }
+};
+}  // namespace utils